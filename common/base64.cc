@@ -58,6 +58,18 @@
 
 #include "base64_data-inl.h"
 
+/*
+ * SSSE3 / AVX2 kernels for the bulk of the data, picked at runtime,
+ * the scalar code does the tail (and the padding).
+ * Encode: W. Mula, "Base64 encoding with SIMD instructions".
+ * Decode: W. Mula, D. Lemire, "Faster Base64 Encoding and Decoding
+ *         using AVX2 Instructions" (validating pshufb lookup).
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BASE64_SIMD 1
+#include <immintrin.h>
+#endif
+
 #define BADCHAR 0x01FFFFFF
 
 /**
@@ -77,7 +89,7 @@
 #define CHARPAD '\0'
 #endif
 
-int base64_encode(char* dest, const char* str, int len)
+static int base64_encode_scalar(char* dest, const char* str, int len)
 {
     int i;
     uint8_t* p = (uint8_t*) dest;
@@ -116,7 +128,7 @@ int base64_encode(char* dest, const char* str, int len)
 }
 
 #ifdef WORDS_BIGENDIAN   /* BIG ENDIAN -- SUN / IBM / MOTOROLA */
-int base64_decode(char* dest, const char* src, int len)
+static int base64_decode_scalar(char* dest, const char* src, int len)
 {
     if (len == 0) return 0;
 
@@ -184,7 +196,7 @@ int base64_decode(char* dest, const char* src, int len)
 
 #else /* LITTLE  ENDIAN -- INTEL AND FRIENDS */
 
-int base64_decode(char* dest, const char* src, int len)
+static int base64_decode_scalar(char* dest, const char* src, int len)
 {
     if (len == 0) return 0;
 
@@ -262,3 +274,240 @@ int base64_decode(char* dest, const char* src, int len)
 
 #endif  /* if bigendian / else / endif */
 
+
+#ifdef BASE64_SIMD
+
+enum { kBase64Scalar, kBase64SSSE3, kBase64AVX2 };
+
+static int base64_simd_level()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        return kBase64AVX2;
+    if (__builtin_cpu_supports("ssse3"))
+        return kBase64SSSE3;
+    return kBase64Scalar;
+}
+
+/* 12 bytes (in the low 12 of a lane) -> 16 characters */
+__attribute__((target("ssse3")))
+static inline __m128i enc_translate_ssse3(__m128i in)
+{
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+    const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    const __m128i indices = _mm_or_si128(t1, t3);
+
+    /* 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12 */
+    __m128i index = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+    const __m128i less = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+    index = _mm_or_si128(index, _mm_and_si128(less, _mm_set1_epi8(13)));
+
+    const __m128i shift = _mm_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0);
+    return _mm_add_epi8(_mm_shuffle_epi8(shift, index), indices);
+}
+
+__attribute__((target("ssse3")))
+static int base64_encode_ssse3(char* dest, const char* str, int len, int* used)
+{
+    int i = 0;
+    int o = 0;
+    /* 16 bytes are loaded for 12 */
+    for (; len - i >= 16; i += 12, o += 16) {
+        const __m128i in = _mm_loadu_si128((const __m128i*)(str + i));
+        _mm_storeu_si128((__m128i*)(dest + o), enc_translate_ssse3(in));
+    }
+
+    *used = i;
+    return o;
+}
+
+__attribute__((target("avx2")))
+static int base64_encode_avx2(char* dest, const char* str, int len, int* used)
+{
+    const __m256i shuffle = _mm256_setr_epi8(
+        1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10,
+        1, 0, 2, 1, 4, 3, 5, 4, 7, 6, 8, 7, 10, 9, 11, 10);
+    const __m256i shift = _mm256_setr_epi8(
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0,
+        'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+        '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+        '/' - 63, 'A', 0, 0);
+
+    int i = 0;
+    int o = 0;
+    /* two lanes of 12 bytes, the upper load ends 28 bytes in */
+    for (; len - i >= 28; i += 24, o += 32) {
+        const __m128i lo = _mm_loadu_si128((const __m128i*)(str + i));
+        const __m128i hi = _mm_loadu_si128((const __m128i*)(str + i + 12));
+        __m256i in = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        in = _mm256_shuffle_epi8(in, shuffle);
+
+        const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+        const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+        const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        const __m256i indices = _mm256_or_si256(t1, t3);
+
+        __m256i index = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+        const __m256i less = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+        index = _mm256_or_si256(index, _mm256_and_si256(less, _mm256_set1_epi8(13)));
+
+        const __m256i out = _mm256_add_epi8(_mm256_shuffle_epi8(shift, index), indices);
+        _mm256_storeu_si256((__m256i*)(dest + o), out);
+    }
+
+    *used = i;
+    return o;
+}
+
+/*
+ * 16 characters -> 12 bytes in the low 12 of the lane, false on any byte
+ * outside the alphabet (the padding included)
+ */
+__attribute__((target("ssse3")))
+static inline bool dec_translate_ssse3(__m128i in, __m128i* out)
+{
+    const __m128i lut_lo = _mm_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i mask_2f = _mm_set1_epi8(0x2f);
+
+    const __m128i hi_nibbles = _mm_and_si128(_mm_srli_epi32(in, 4), mask_2f);
+    const __m128i lo_nibbles = _mm_and_si128(in, mask_2f);
+    const __m128i hi = _mm_shuffle_epi8(lut_hi, hi_nibbles);
+    const __m128i lo = _mm_shuffle_epi8(lut_lo, lo_nibbles);
+    const __m128i bad = _mm_and_si128(lo, hi);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(bad, _mm_setzero_si128())) != 0xFFFF)
+        return false;
+
+    const __m128i eq_2f = _mm_cmpeq_epi8(in, mask_2f);
+    const __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles));
+    in = _mm_add_epi8(in, roll);
+
+    const __m128i merge_ab_bc = _mm_maddubs_epi16(in, _mm_set1_epi32(0x01400140));
+    const __m128i merged = _mm_madd_epi16(merge_ab_bc, _mm_set1_epi32(0x00011000));
+    *out = _mm_shuffle_epi8(merged, _mm_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+    return true;
+}
+
+/*
+ * the kernels stop 24 (SSSE3) / 48 (AVX2) characters before the end: the
+ * stores write 16 / 32 bytes, and the last quantum (padding) stays scalar
+ */
+__attribute__((target("ssse3")))
+static int base64_decode_ssse3(char* dest, const char* src, int len, int* used)
+{
+    int i = 0;
+    int o = 0;
+    for (; len - i >= 24; i += 16, o += 12) {
+        __m128i out;
+        if (!dec_translate_ssse3(_mm_loadu_si128((const __m128i*)(src + i)), &out))
+            break;
+        _mm_storeu_si128((__m128i*)(dest + o), out);
+    }
+
+    *used = i;
+    return o;
+}
+
+__attribute__((target("avx2")))
+static int base64_decode_avx2(char* dest, const char* src, int len, int* used)
+{
+    const __m256i lut_lo = _mm256_setr_epi8(
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+        0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+        0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+        0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+        0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i pack = _mm256_setr_epi8(
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+        2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    const __m256i mask_2f = _mm256_set1_epi8(0x2f);
+
+    int i = 0;
+    int o = 0;
+    for (; len - i >= 48; i += 32, o += 24) {
+        __m256i in = _mm256_loadu_si256((const __m256i*)(src + i));
+
+        const __m256i hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(in, 4), mask_2f);
+        const __m256i lo_nibbles = _mm256_and_si256(in, mask_2f);
+        const __m256i hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+        const __m256i lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+        if (!_mm256_testz_si256(lo, hi))
+            break;
+
+        const __m256i eq_2f = _mm256_cmpeq_epi8(in, mask_2f);
+        const __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+        in = _mm256_add_epi8(in, roll);
+
+        const __m256i merge_ab_bc = _mm256_maddubs_epi16(in, _mm256_set1_epi32(0x01400140));
+        __m256i out = _mm256_madd_epi16(merge_ab_bc, _mm256_set1_epi32(0x00011000));
+        out = _mm256_shuffle_epi8(out, pack);
+        out = _mm256_permutevar8x32_epi32(out, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm256_storeu_si256((__m256i*)(dest + o), out);
+    }
+
+    *used = i;
+    return o;
+}
+
+#endif /* BASE64_SIMD */
+
+int base64_encode(char* dest, const char* str, int len)
+{
+    int used = 0;
+    int out = 0;
+#ifdef BASE64_SIMD
+    static const int level = base64_simd_level();
+    if (level == kBase64AVX2)
+        out = base64_encode_avx2(dest, str, len, &used);
+    else if (level == kBase64SSSE3)
+        out = base64_encode_ssse3(dest, str, len, &used);
+#endif /* BASE64_SIMD */
+
+    return out + base64_encode_scalar(dest + out, str + used, len - used);
+}
+
+int base64_decode(char* dest, const char* src, int len)
+{
+    int used = 0;
+    int out = 0;
+#ifdef BASE64_SIMD
+    static const int level = base64_simd_level();
+    if (len % 4 == 0) {
+        if (level == kBase64AVX2)
+            out = base64_decode_avx2(dest, src, len, &used);
+        if (level >= kBase64SSSE3) {
+            int more = 0;
+            out += base64_decode_ssse3(dest + out, src + used, len - used, &more);
+            used += more;
+        }
+    }
+#endif /* BASE64_SIMD */
+
+    /* a bad character stops the kernels, the scalar code reports it */
+    const int n = base64_decode_scalar(dest + out, src + used, len - used);
+    return (n < 0) ? -1 : out + n;
+}
@@ -58,6 +58,7 @@
 						'./linux/port_posix.cc',
 						'./linux/port_posix_sse.cc',
 						'./linux/env_posix.cc',
+						'./linux/io_uring_posix.cc',
 					],
 				}],
 				['OS=="win"', {
@@ -110,6 +111,7 @@
 						'./file_util.h',
 						'./sys_time.h',
 						'./xpress.h',
+						'./compression.h',
 						'./atomic_pointer.h',
 						'./mutexlock.h',
 						'./producer_consumer_queue.h',
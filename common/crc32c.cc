@@ -8,6 +8,7 @@
 #include "crc32c.h"
 
 #include <stdint.h>
+#include <vector>
 
 #include "port.h"
 #include "coding.h"
@@ -361,4 +362,125 @@ uint32_t Extend(uint32_t crc, const char* buf, size_t size)
     return l ^ 0xffffffffu;
 }
 
+// Polynomials below are in the same reflected representation as the
+// crc register: bit 31 holds x^0 and bit 0 holds x^31.
+static const uint32_t kPoly = 0x82f63b78u;
+
+// Return a * b mod P.
+static uint32_t MultModP(uint32_t a, uint32_t b)
+{
+    uint32_t m = 1u << 31;
+    uint32_t p = 0;
+    for (;;)
+    {
+        if (a & m)
+        {
+            p ^= b;
+            if ((a & (m - 1)) == 0)
+            {
+                break;
+            }
+        }
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ kPoly : b >> 1;
+    }
+    return p;
+}
+
+// x^(2^k) mod P for every k a 64-bit length in bits can need.
+struct PowerTable
+{
+    uint32_t pow[67];
+
+    PowerTable()
+    {
+        uint32_t p = 1u << 30;  // x^1
+        for (int k = 0; k < 67; k++)
+        {
+            pow[k] = p;
+            p = MultModP(p, p);
+        }
+    }
+};
+
+// Return x^(8n) mod P, the factor that shifts a crc past n zero bytes.
+static uint32_t XPow8N(uint64_t n)
+{
+    static const PowerTable table;
+    uint32_t p = 1u << 31;  // x^0
+    int k = 3;
+    while (n)
+    {
+        if (n & 1)
+        {
+            p = MultModP(table.pow[k], p);
+        }
+        n >>= 1;
+        k++;
+    }
+    return p;
+}
+
+uint32_t Combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b)
+{
+    // The pre and post inversions of the two crcs cancel out, leaving
+    // crc(AB) = crc(A) * x^(8 * len(B)) + crc(B).
+    return MultModP(XPow8N(len_b), crc_a) ^ crc_b;
+}
+
+// Pieces smaller than this are not worth handing to another thread.
+static const size_t kMinPieceSize = 1 << 20;
+
+struct Piece
+{
+    const char* data;
+    size_t n;
+    uint32_t crc;
+};
+
+static void SumPiece(Piece* piece)
+{
+    piece->crc = Extend(0, piece->data, piece->n);
+}
+
+uint32_t Value(const char* data, size_t n, int threads)
+{
+    size_t pieces = n / kMinPieceSize;
+    if (threads > 1 && pieces > static_cast<size_t>(threads))
+    {
+        pieces = threads;
+    }
+    if (threads <= 1 || pieces <= 1)
+    {
+        return Extend(0, data, n);
+    }
+
+    std::vector<Piece> sums(pieces);
+    size_t size = n / pieces;
+    for (size_t i = 0; i < pieces; i++)
+    {
+        sums[i].data = data + i * size;
+        sums[i].n = (i + 1 == pieces) ? n - i * size : size;
+    }
+
+    // The calling thread sums the first piece itself.
+    std::vector<port::Thread> workers;
+    for (size_t i = 1; i < pieces; i++)
+    {
+        workers.push_back(port::Thread(&SumPiece, &sums[i]));
+    }
+    SumPiece(&sums[0]);
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        workers[i].join();
+    }
+
+    uint32_t crc = sums[0].crc;
+    for (size_t i = 1; i < pieces; i++)
+    {
+        crc = Combine(crc, sums[i].crc, sums[i].n);
+    }
+    return crc;
+}
+
 }  // namespace crc32c
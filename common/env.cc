@@ -4,10 +4,41 @@
 
 #include "env.h"
 
+#include <string.h>
+
 Env::~Env()
 {
 }
 
+Status Env::NewMmapSequentialFile(const std::string& fname, SequentialFile** result)
+{
+    return NewSequentialFile(fname, result);
+}
+
+void Env::SetBackgroundThreads(int number, Priority pri)
+{
+}
+
+int Env::GetBackgroundThreads(Priority pri)
+{
+    return 1;
+}
+
+unsigned int Env::GetThreadPoolQueueLen(Priority pri) const
+{
+    return 0;
+}
+
+void Env::GetThreadPoolStats(Priority pri, ThreadPoolStats* stats) const
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+Status Env::NewAsyncWritableFile(const std::string& fname, WritableFile** result)
+{
+    return NewWritableFile(fname, result);
+}
+
 Status Env::NewAppendableFile(const std::string& fname, WritableFile** result)
 {
     return Status::NotSupported("NewAppendableFile", make_slice(fname));
@@ -17,14 +48,52 @@ SequentialFile::~SequentialFile()
 {
 }
 
+void SequentialFile::Hint(AccessPattern pattern)
+{
+}
+
+Status SequentialFile::Prefetch(uint64_t offset, size_t n)
+{
+    return Status::OK();
+}
+
 RandomAccessFile::~RandomAccessFile()
 {
 }
 
+void RandomAccessFile::Hint(AccessPattern pattern) const
+{
+}
+
+Status RandomAccessFile::Prefetch(uint64_t offset, size_t n) const
+{
+    return Status::OK();
+}
+
+Status RandomAccessFile::MultiRead(ReadRequest* reqs, size_t n) const
+{
+    Status result;
+    for (size_t i = 0; i < n; i++)
+    {
+        reqs[i].status = Read(reqs[i].offset, reqs[i].n, &reqs[i].result, reqs[i].scratch);
+        if (result.ok() && !reqs[i].status.ok())
+        {
+            result = reqs[i].status;
+        }
+    }
+    return result;
+}
+
 WritableFile::~WritableFile()
 {
 }
 
+void WritableFile::SyncAsync(SyncCallback callback, void* arg)
+{
+    Status s = Sync();
+    (*callback)(arg, s);
+}
+
 Logger::~Logger()
 {
 }
@@ -17,13 +17,13 @@
 #include <vector>
 #include <stdarg.h>
 #include <stdint.h>
+#include "slice.h"
 #include "status.h"
 
 class FileLock;
 class Logger;
 class RandomAccessFile;
 class SequentialFile;
-class Slice;
 class WritableFile;
 
 class Env
@@ -49,6 +49,15 @@ public:
     virtual Status NewSequentialFile(const std::string& fname,
                                      SequentialFile** result) = 0;
 
+    // Like NewSequentialFile(), but the file is mapped into memory and
+    // Read() returns data inside the mapping instead of copying it into
+    // "scratch"; the data stays valid until the file is deleted.  Only the
+    // contents at the time of the call are read.
+    //
+    // The default implementation returns NewSequentialFile().
+    virtual Status NewMmapSequentialFile(const std::string& fname,
+                                         SequentialFile** result);
+
     // Create a brand new random access read-only file with the
     // specified name.  On success, stores a pointer to the new file in
     // *result and returns OK.  On failure stores NULL in *result and
@@ -85,6 +94,15 @@ public:
     virtual Status NewAppendableFile(const std::string& fname,
                                      WritableFile** result);
 
+    // Like NewWritableFile(), but the file writes behind the caller:
+    // Append() only copies into buffers that are written out, and synced
+    // every few megabytes, in the background.  Use SyncAsync() to learn
+    // when data is durable without waiting for it.
+    //
+    // The default implementation returns NewWritableFile().
+    virtual Status NewAsyncWritableFile(const std::string& fname,
+                                        WritableFile** result);
+
     // Returns true iff the named file exists.
     virtual bool FileExists(const std::string& fname) = 0;
 
@@ -131,7 +149,13 @@ public:
     // REQUIRES: lock has not already been unlocked.
     virtual Status UnlockFile(FileLock* lock) = 0;
 
-    // Arrange to run "(*function)(arg)" once in a background thread.
+    // Priority of the thread pool a background job is scheduled in.
+    // Each priority has its own pool, so long LOW jobs never delay
+    // HIGH ones.
+    enum Priority { LOW, HIGH, TOTAL };
+
+    // Arrange to run "(*function)(arg)" once in a background thread, in
+    // the thread pool specified by pri.
     //
     // "function" may run in an unspecified thread.  Multiple functions
     // added to the same Env may run concurrently in different threads.
@@ -139,7 +163,43 @@ public:
     // serialized.
     virtual void Schedule(
         void (*function)(void* arg),
-        void* arg) = 0;
+        void* arg,
+        Priority pri = LOW) = 0;
+
+    // Set the number of background worker threads of the thread pool
+    // for pri.  Each pool has one thread by default.  Lowering the number
+    // lets the surplus threads finish their queued jobs and then idle.
+    //
+    // The default implementation does nothing.
+    virtual void SetBackgroundThreads(int number, Priority pri = LOW);
+
+    // Return the number of background worker threads of the pool for pri.
+    //
+    // The default implementation returns 1.
+    virtual int GetBackgroundThreads(Priority pri = LOW);
+
+    // Return the number of jobs scheduled in the pool for pri that have
+    // not started running yet.
+    //
+    // The default implementation returns 0.
+    virtual unsigned int GetThreadPoolQueueLen(Priority pri = LOW) const;
+
+    // Counters of a thread pool since the Env was created.
+    struct ThreadPoolStats
+    {
+        uint64_t scheduled;          // jobs passed to Schedule()
+        uint64_t completed;          // jobs that have returned
+        uint64_t stolen;             // jobs run by a thread that stole them
+        uint64_t queue_len;          // jobs waiting to start
+        uint64_t total_wait_micros;  // time from Schedule() to start, summed
+        uint64_t max_wait_micros;    // longest time from Schedule() to start
+        uint64_t total_run_micros;   // running time of completed jobs, summed
+    };
+
+    // Store the counters of the pool for pri in *stats.
+    //
+    // The default implementation stores all zeros.
+    virtual void GetThreadPoolStats(Priority pri, ThreadPoolStats* stats) const;
 
     // Start a new thread, invoking "function(arg)" within the new thread.
     // When "function(arg)" returns, the thread will be destroyed.
@@ -167,6 +227,16 @@ private:
     void operator=(const Env&);
 };
 
+// How a file is about to be read, see SequentialFile::Hint().
+enum AccessPattern
+{
+    kAccessNormal,      // No particular order
+    kAccessSequential,  // From lower to higher offsets; read ahead more
+    kAccessRandom,      // In no order; do not read ahead
+    kAccessWillNeed,    // All of it soon; start reading now
+    kAccessDontNeed     // Not again; drop it from the cache
+};
+
 // A file abstraction for reading sequentially through a file
 class SequentialFile
 {
@@ -193,12 +263,41 @@ public:
     // REQUIRES: External synchronization
     virtual Status Skip(uint64_t n) = 0;
 
+    // Tell how the file is about to be read, so that readahead and caching
+    // can be tuned to it.  Only a hint: reads behave the same either way.
+    //
+    // The default implementation does nothing.
+    //
+    // REQUIRES: External synchronization
+    virtual void Hint(AccessPattern pattern);
+
+    // Start reading "n" bytes at "offset" from the start of the file in the
+    // background, so that reading them later need not wait for the device.
+    //
+    // The default implementation does nothing and returns OK.
+    //
+    // REQUIRES: External synchronization
+    virtual Status Prefetch(uint64_t offset, size_t n);
+
 private:
     // No copying allowed
     SequentialFile(const SequentialFile&);
     void operator=(const SequentialFile&);
 };
 
+// One of the reads passed to RandomAccessFile::MultiRead().
+struct ReadRequest
+{
+    // Read up to "n" bytes starting at "offset" into "scratch[0..n-1]".
+    uint64_t offset;
+    size_t n;
+    char* scratch;
+
+    // Set like the "*result" and the return value of Read().
+    Slice result;
+    Status status;
+};
+
 // A file abstraction for randomly reading the contents of a file.
 class RandomAccessFile
 {
@@ -218,6 +317,22 @@ public:
     virtual Status Read(uint64_t offset, size_t n, Slice* result,
                         char* scratch) const = 0;
 
+    // Perform the reads reqs[0,n-1], setting the result and status of
+    // each as Read() would.  Returns OK if every read succeeded, otherwise
+    // the status of the first one that failed.  Implementations may keep
+    // all the reads in flight at once.
+    //
+    // The default implementation calls Read() for each request in turn.
+    //
+    // Safe for concurrent use by multiple threads.
+    virtual Status MultiRead(ReadRequest* reqs, size_t n) const;
+
+    // Like SequentialFile::Hint() and SequentialFile::Prefetch().
+    //
+    // Safe for concurrent use by multiple threads.
+    virtual void Hint(AccessPattern pattern) const;
+    virtual Status Prefetch(uint64_t offset, size_t n) const;
+
 private:
     // No copying allowed
     RandomAccessFile(const RandomAccessFile&);
@@ -238,6 +353,18 @@ public:
     virtual Status Flush() = 0;
     virtual Status Sync() = 0;
 
+    // Called with the outcome of a SyncAsync().
+    typedef void (*SyncCallback)(void* arg, const Status& s);
+
+    // Like Sync(), but may return before the data is durable.  Calls
+    // "(*callback)(arg, s)" once everything appended before the call is
+    // durable, or with the error that prevented it.  The callback may run
+    // in another thread or before SyncAsync() returns; the callbacks of
+    // successive calls run in order.
+    //
+    // The default implementation calls Sync() and then the callback.
+    virtual void SyncAsync(SyncCallback callback, void* arg);
+
 private:
     // No copying allowed
     WritableFile(const WritableFile&);
@@ -309,6 +436,10 @@ public:
     {
         return target_->NewSequentialFile(f, r);
     }
+    Status NewMmapSequentialFile(const std::string& f, SequentialFile** r)
+    {
+        return target_->NewMmapSequentialFile(f, r);
+    }
     Status NewRandomAccessFile(const std::string& f, RandomAccessFile** r)
     {
         return target_->NewRandomAccessFile(f, r);
@@ -317,6 +448,10 @@ public:
     {
         return target_->NewWritableFile(f, r);
     }
+    Status NewAsyncWritableFile(const std::string& f, WritableFile** r)
+    {
+        return target_->NewAsyncWritableFile(f, r);
+    }
     Status NewAppendableFile(const std::string& f, WritableFile** r)
     {
         return target_->NewAppendableFile(f, r);
@@ -357,9 +492,25 @@ public:
     {
         return target_->UnlockFile(l);
     }
-    void Schedule(void (*f)(void*), void* a)
+    void Schedule(void (*f)(void*), void* a, Priority pri = LOW)
+    {
+        return target_->Schedule(f, a, pri);
+    }
+    void SetBackgroundThreads(int number, Priority pri = LOW)
+    {
+        target_->SetBackgroundThreads(number, pri);
+    }
+    int GetBackgroundThreads(Priority pri = LOW)
+    {
+        return target_->GetBackgroundThreads(pri);
+    }
+    unsigned int GetThreadPoolQueueLen(Priority pri = LOW) const
+    {
+        return target_->GetThreadPoolQueueLen(pri);
+    }
+    void GetThreadPoolStats(Priority pri, ThreadPoolStats* stats) const
     {
-        return target_->Schedule(f, a);
+        target_->GetThreadPoolStats(pri, stats);
     }
     void StartThread(void (*f)(void*), void* a)
     {
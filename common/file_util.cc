@@ -10,72 +10,77 @@
 
 #include "env.h"
 
-/*
+// Bytes copied per read, and how far ahead of the copy the source is
+// pulled into the page cache.
+static const size_t kCopyBufferSize = 64 * 1024;
+static const uint64_t kCopyReadAhead = 1024 * 1024;
+
 // Utility function to copy a file up to a specified length
 Status CopyFile(Env* env, const std::string& source,
                 const std::string& destination, uint64_t size, bool use_fsync)
 {
-    const EnvOptions soptions;
-    Status s;
-    std::unique_ptr<SequentialFileReader> src_reader;
-    std::unique_ptr<WritableFileWriter> dest_writer;
-
+    SequentialFile* srcfile = NULL;
+    WritableFile* destfile = NULL;
+    Status s = env->NewSequentialFile(source, &srcfile);
+    if (s.ok())
     {
-        std::unique_ptr<SequentialFile> srcfile;
-        s = env->NewSequentialFile(source, &srcfile, soptions);
-        std::unique_ptr<WritableFile> destfile;
-        if (s.ok())
-        {
-            s = env->NewWritableFile(destination, &destfile, soptions);
-        }
-        else
-        {
-            return s;
-        }
-
-        if (size == 0)
-        {
-            // default argument means copy everything
-            if (s.ok())
-            {
-                s = env->GetFileSize(source, &size);
-            }
-            else
-            {
-                return s;
-            }
-        }
-        src_reader.reset(new SequentialFileReader(std::move(srcfile)));
-        dest_writer.reset(new WritableFileWriter(std::move(destfile), soptions));
+        s = env->NewWritableFile(destination, &destfile);
+    }
+    if (s.ok() && size == 0)
+    {
+        // default argument means copy everything
+        s = env->GetFileSize(source, &size);
+    }
+    if (!s.ok())
+    {
+        delete srcfile;
+        delete destfile;
+        return s;
     }
 
-    char buffer[4096];
+    srcfile->Hint(kAccessSequential);
+    std::string buffer(kCopyBufferSize, '\0');
+    uint64_t offset = 0;
+    uint64_t prefetched = 0;
     Slice slice;
     while (size > 0)
     {
-        size_t bytes_to_read = std::min(sizeof(buffer), static_cast<size_t>(size));
-        if (s.ok())
+        if (offset + kCopyBufferSize > prefetched)
         {
-            s = src_reader->Read(bytes_to_read, &slice, buffer);
+            srcfile->Prefetch(prefetched, static_cast<size_t>(std::min(kCopyReadAhead, size)));
+            prefetched += kCopyReadAhead;
+        }
+        size_t bytes_to_read = static_cast<size_t>(std::min<uint64_t>(size, kCopyBufferSize));
+        s = srcfile->Read(bytes_to_read, &slice, &buffer[0]);
+        if (s.ok() && slice.size() == 0)
+        {
+            s = Status::Corruption("file too small");
         }
         if (s.ok())
         {
-            if (slice.size() == 0)
-            {
-                return Status::Corruption("file too small");
-            }
-            s = dest_writer->Append(slice);
+            s = destfile->Append(slice);
         }
         if (!s.ok())
         {
-            return s;
+            break;
         }
+        offset += slice.size();
         size -= slice.size();
     }
-    dest_writer->Sync(use_fsync);
-    return Status::OK();
+    if (s.ok() && use_fsync)
+    {
+        s = destfile->Sync();
+    }
+    if (s.ok())
+    {
+        s = destfile->Close();
+    }
+    delete srcfile;
+    delete destfile;
+    return s;
 }
 
+/*
 // Utility function to create a file with the provided contents
 Status CreateFile(Env* env, const std::string& destination,
                   const std::string& contents)
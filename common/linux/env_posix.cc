@@ -3,29 +3,38 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include <sys/types.h>
+#include <assert.h>
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
+#include <algorithm>
+#include <atomic>
 #include <deque>
 #include <limits>
 #include <set>
+#include <vector>
 #include "env.h"
+#include "aligned_buffer.h"
 #include "slice.h"
 #include "port.h"
 #include "logging.h"
 #include "mutexlock.h"
 #include "posix_logger.h"
+#include "io_uring_posix.h"
 
 namespace {
 
@@ -44,6 +53,78 @@ static Status PosixError(const std::string& context, int err_number)
     }
 }
 
+static int FadviseAdvice(AccessPattern pattern)
+{
+    switch (pattern)
+    {
+        case kAccessSequential:
+            return POSIX_FADV_SEQUENTIAL;
+        case kAccessRandom:
+            return POSIX_FADV_RANDOM;
+        case kAccessWillNeed:
+            return POSIX_FADV_WILLNEED;
+        case kAccessDontNeed:
+            return POSIX_FADV_DONTNEED;
+        default:
+            return POSIX_FADV_NORMAL;
+    }
+}
+
+static int MadviseAdvice(AccessPattern pattern)
+{
+    switch (pattern)
+    {
+        case kAccessSequential:
+            return MADV_SEQUENTIAL;
+        case kAccessRandom:
+            return MADV_RANDOM;
+        case kAccessWillNeed:
+            return MADV_WILLNEED;
+        case kAccessDontNeed:
+            return MADV_DONTNEED;
+        default:
+            return MADV_NORMAL;
+    }
+}
+
+// Start reading [offset, offset + n) of fd into the page cache.
+static Status ReadAhead(const std::string& fname, int fd, uint64_t offset, size_t n)
+{
+    if (readahead(fd, static_cast<off64_t>(offset), n) != 0)
+    {
+        return PosixError(fname, errno);
+    }
+    return Status::OK();
+}
+
+// Fault in the pages of base[offset, offset + n), clipped to the length of
+// the mapping, in the background.
+static Status MadvisePrefetch(const std::string& fname, char* base, size_t length,
+                              uint64_t offset, size_t n)
+{
+    if (offset >= length)
+    {
+        return Status::OK();
+    }
+    n = static_cast<size_t>(std::min<uint64_t>(n, length - offset));
+    const size_t page = getpagesize();
+    const size_t begin = static_cast<size_t>(offset) & ~(page - 1);
+    if (madvise(base + begin, n + (static_cast<size_t>(offset) - begin), MADV_WILLNEED) != 0)
+    {
+        return PosixError(fname, errno);
+    }
+    return Status::OK();
+}
+
+static void PthreadCall(const char* label, int result)
+{
+    if (result != 0)
+    {
+        fprintf(stderr, "pthread %s: %s\n", label, strerror(result));
+        abort();
+    }
+}
+
 // Helper class to limit resource usage to avoid exhaustion.
 // Currently used to limit read-only file descriptors and mmap file usage
 // so that we do not end up running out of file descriptors, virtual memory,
@@ -147,8 +228,294 @@ public:
         }
         return Status::OK();
     }
+
+    virtual void Hint(AccessPattern pattern)
+    {
+        posix_fadvise(fileno(file_), 0, 0, FadviseAdvice(pattern));
+    }
+
+    virtual Status Prefetch(uint64_t offset, size_t n)
+    {
+        return ReadAhead(filename_, fileno(file_), offset, n);
+    }
+};
+
+// mmap() based sequential reads: Read() returns slices into the mapping,
+// which is read ahead and unmapped behind the cursor as it goes
+class PosixMmapSequentialFile: public SequentialFile
+{
+private:
+    // Pages more than this far behind the cursor are dropped
+    static const size_t kDropBehind = 1 << 20;
+
+    std::string filename_;
+    char* mmapped_region_;
+    size_t length_;
+    size_t offset_;
+    size_t dropped_;   // [0, dropped_) has been handed back to the kernel
+    Limiter* limiter_;
+
+    void DropBehind()
+    {
+        if (offset_ >= dropped_ + 2 * kDropBehind)
+        {
+            const size_t end = (offset_ - kDropBehind) & ~(kDropBehind - 1);
+            madvise(mmapped_region_ + dropped_, end - dropped_, MADV_DONTNEED);
+            dropped_ = end;
+        }
+    }
+
+public:
+    // base[0,length-1] contains the mmapped contents of the file.
+    PosixMmapSequentialFile(const std::string& fname, void* base, size_t length,
+                            Limiter* limiter)
+        : filename_(fname), mmapped_region_(reinterpret_cast<char*>(base)),
+          length_(length), offset_(0), dropped_(0), limiter_(limiter)
+    {
+        madvise(mmapped_region_, length_, MADV_SEQUENTIAL);
+    }
+
+    virtual ~PosixMmapSequentialFile()
+    {
+        munmap(mmapped_region_, length_);
+        limiter_->Release();
+    }
+
+    virtual Status Read(size_t n, Slice* result, char* scratch)
+    {
+        n = std::min(n, length_ - offset_);
+        *result = Slice(mmapped_region_ + offset_, n);
+        offset_ += n;
+        DropBehind();
+        return Status::OK();
+    }
+
+    virtual Status Skip(uint64_t n)
+    {
+        offset_ += static_cast<size_t>(std::min<uint64_t>(n, length_ - offset_));
+        DropBehind();
+        return Status::OK();
+    }
+
+    virtual void Hint(AccessPattern pattern)
+    {
+        madvise(mmapped_region_, length_, MadviseAdvice(pattern));
+    }
+
+    virtual Status Prefetch(uint64_t offset, size_t n)
+    {
+        return MadvisePrefetch(filename_, mmapped_region_, length_, offset, n);
+    }
 };
 
+// Submission depth of the per-thread rings used by MultiRead().
+static const unsigned kIoUringDepth = 64;
+
+static pthread_once_t io_uring_once = PTHREAD_ONCE_INIT;
+static pthread_key_t io_uring_key;
+static std::atomic<bool> io_uring_unavailable(false);
+
+static void DeleteIoUring(void* ring)
+{
+    delete reinterpret_cast<IoUring*>(ring);
+}
+
+static void InitIoUringKey()
+{
+    PthreadCall("key_create", pthread_key_create(&io_uring_key, &DeleteIoUring));
+}
+
+// Return the calling thread's ring, or NULL if io_uring cannot be used.
+static IoUring* ThreadIoUring()
+{
+    pthread_once(&io_uring_once, InitIoUringKey);
+    IoUring* ring = reinterpret_cast<IoUring*>(pthread_getspecific(io_uring_key));
+    if (ring == NULL && !io_uring_unavailable)
+    {
+        ring = IoUring::Create(kIoUringDepth);
+        if (ring == NULL)
+        {
+            // Do not retry the setup on every call.
+            io_uring_unavailable = true;
+        }
+        else
+        {
+            PthreadCall("setspecific", pthread_setspecific(io_uring_key, ring));
+        }
+    }
+    return ring;
+}
+
+static void DropThreadIoUring()
+{
+    IoUring* ring = reinterpret_cast<IoUring*>(pthread_getspecific(io_uring_key));
+    PthreadCall("setspecific", pthread_setspecific(io_uring_key, NULL));
+    delete ring;
+}
+
+// Read reqs[0,n-1] from fd with up to one preadv() per run of requests
+// that are adjacent in the file.
+static Status PreadvMultiRead(const std::string& fname, int fd, ReadRequest* reqs, size_t n)
+{
+    Status result;
+    std::vector<struct iovec> iov;
+    size_t i = 0;
+    while (i < n)
+    {
+        size_t j = i + 1;
+        while (j < n && j - i < IOV_MAX && reqs[j].offset == reqs[j - 1].offset + reqs[j - 1].n)
+        {
+            j++;
+        }
+
+        // reqs[k] is the first request of the run not yet filled, of which
+        // "done" bytes have been read.
+        size_t k = i;
+        size_t done = 0;
+        Status s;
+        while (k < j)
+        {
+            iov.clear();
+            for (size_t m = k; m < j; m++)
+            {
+                struct iovec v;
+                v.iov_base = reqs[m].scratch + (m == k ? done : 0);
+                v.iov_len = reqs[m].n - (m == k ? done : 0);
+                iov.push_back(v);
+            }
+            ssize_t r = preadv(fd, &iov[0], static_cast<int>(iov.size()),
+                               static_cast<off_t>(reqs[k].offset + done));
+            if (r < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                s = PosixError(fname, errno);
+                break;
+            }
+            if (r == 0)
+            {
+                break;  // End of file
+            }
+            size_t left = static_cast<size_t>(r);
+            while (k < j && left >= reqs[k].n - done)
+            {
+                left -= reqs[k].n - done;
+                reqs[k].result = Slice(reqs[k].scratch, reqs[k].n);
+                reqs[k].status = Status::OK();
+                k++;
+                done = 0;
+            }
+            done += left;
+        }
+        for (; k < j; k++)
+        {
+            reqs[k].result = Slice(reqs[k].scratch, done);
+            reqs[k].status = s;
+            done = 0;
+        }
+        if (result.ok() && !s.ok())
+        {
+            result = s;
+        }
+        i = j;
+    }
+    return result;
+}
+
+// Read reqs[0,n-1] from fd through ring, keeping up to the ring depth
+// in flight.  Short reads are resubmitted for the rest of the request.
+// Returns false if the ring failed, after which the caller must not use
+// it again and finish the requests whose "status" is not yet set, which
+// are listed in *unfinished.
+static bool IoUringMultiRead(IoUring* ring, const std::string& fname, int fd,
+                             ReadRequest* reqs, size_t n, std::vector<size_t>* unfinished)
+{
+    std::vector<size_t> done(n, 0);  // Bytes read so far per request
+    std::vector<struct iovec> iov(n);
+    std::deque<size_t> ready;        // Requests with more to read
+    for (size_t i = 0; i < n; i++)
+    {
+        reqs[i].status = Status::OK();
+        ready.push_back(i);
+    }
+
+    size_t in_flight = 0;
+    bool ok = true;
+    while (!ready.empty() || in_flight > 0)
+    {
+        while (!ready.empty() && in_flight < ring->entries())
+        {
+            struct io_uring_sqe* sqe = ring->GetSqe();
+            if (sqe == NULL)
+            {
+                break;
+            }
+            size_t i = ready.front();
+            ready.pop_front();
+            iov[i].iov_base = reqs[i].scratch + done[i];
+            iov[i].iov_len = reqs[i].n - done[i];
+            sqe->opcode = IORING_OP_READV;
+            sqe->fd = fd;
+            sqe->addr = reinterpret_cast<uintptr_t>(&iov[i]);
+            sqe->len = 1;
+            sqe->off = reqs[i].offset + done[i];
+            sqe->user_data = i;
+            in_flight++;
+        }
+
+        int r = ring->Submit(1);
+        if (r < 0 && r != -EBUSY && r != -EAGAIN)
+        {
+            ok = false;
+            break;
+        }
+
+        struct io_uring_cqe* cqe;
+        while (ring->GetCqe(&cqe, false) == 0)
+        {
+            size_t i = static_cast<size_t>(cqe->user_data);
+            int res = cqe->res;
+            ring->SeenCqe();
+            in_flight--;
+            if (res == -EINTR || res == -EAGAIN)
+            {
+                ready.push_back(i);
+            }
+            else if (res < 0)
+            {
+                reqs[i].status = PosixError(fname, -res);
+            }
+            else
+            {
+                done[i] += res;
+                if (res > 0 && done[i] < reqs[i].n)
+                {
+                    ready.push_back(i);
+                }
+            }
+        }
+    }
+
+    for (size_t i = 0; i < n; i++)
+    {
+        reqs[i].result = Slice(reqs[i].scratch, done[i]);
+    }
+    if (!ok)
+    {
+        // Requests still queued or in flight are redone from scratch.
+        for (size_t i = 0; i < n; i++)
+        {
+            if (reqs[i].status.ok() && done[i] < reqs[i].n)
+            {
+                unfinished->push_back(i);
+            }
+        }
+    }
+    return ok;
+}
+
 // pread() based random-access
 class PosixRandomAccessFile: public RandomAccessFile
 {
@@ -208,6 +575,98 @@ public:
         }
         return s;
     }
+
+    // A file opened on every access has nothing to keep the access
+    // pattern on, so only the page cache hints apply to it.
+    virtual void Hint(AccessPattern pattern) const
+    {
+        if (!temporary_fd_)
+        {
+            posix_fadvise(fd_, 0, 0, FadviseAdvice(pattern));
+        }
+        else if (pattern == kAccessWillNeed || pattern == kAccessDontNeed)
+        {
+            int fd = open(filename_.c_str(), O_RDONLY);
+            if (fd >= 0)
+            {
+                posix_fadvise(fd, 0, 0, FadviseAdvice(pattern));
+                close(fd);
+            }
+        }
+    }
+
+    virtual Status Prefetch(uint64_t offset, size_t n) const
+    {
+        if (!temporary_fd_)
+        {
+            return ReadAhead(filename_, fd_, offset, n);
+        }
+        int fd = open(filename_.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return PosixError(filename_, errno);
+        }
+        Status s = ReadAhead(filename_, fd, offset, n);
+        close(fd);
+        return s;
+    }
+
+    // Submits all the reads at once through the calling thread's
+    // io_uring, or falls back to preadv() where io_uring is unavailable.
+    virtual Status MultiRead(ReadRequest* reqs, size_t n) const
+    {
+        if (n == 1)
+        {
+            reqs[0].status = Read(reqs[0].offset, reqs[0].n, &reqs[0].result, reqs[0].scratch);
+            return reqs[0].status;
+        }
+
+        int fd = fd_;
+        if (temporary_fd_)
+        {
+            fd = open(filename_.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                Status s = PosixError(filename_, errno);
+                for (size_t i = 0; i < n; i++)
+                {
+                    reqs[i].result = Slice(reqs[i].scratch, 0);
+                    reqs[i].status = s;
+                }
+                return s;
+            }
+        }
+
+        IoUring* ring = ThreadIoUring();
+        if (ring == NULL)
+        {
+            PreadvMultiRead(filename_, fd, reqs, n);
+        }
+        else
+        {
+            std::vector<size_t> unfinished;
+            if (!IoUringMultiRead(ring, filename_, fd, reqs, n, &unfinished))
+            {
+                DropThreadIoUring();
+                for (size_t i = 0; i < unfinished.size(); i++)
+                {
+                    PreadvMultiRead(filename_, fd, &reqs[unfinished[i]], 1);
+                }
+            }
+        }
+
+        if (temporary_fd_)
+        {
+            // Close the temporary file descriptor opened earlier.
+            close(fd);
+        }
+        Status result;
+        for (size_t i = 0; i < n && result.ok(); i++)
+        {
+            result = reqs[i].status;
+        }
+        return result;
+    }
 };
 
 // mmap() based random-access
@@ -249,6 +708,32 @@ public:
         }
         return s;
     }
+
+    virtual void Hint(AccessPattern pattern) const
+    {
+        madvise(mmapped_region_, length_, MadviseAdvice(pattern));
+    }
+
+    virtual Status Prefetch(uint64_t offset, size_t n) const
+    {
+        return MadvisePrefetch(filename_, reinterpret_cast<char*>(mmapped_region_), length_,
+                               offset, n);
+    }
+
+    virtual Status MultiRead(ReadRequest* reqs, size_t n) const
+    {
+        Status result;
+        for (size_t i = 0; i < n; i++)
+        {
+            reqs[i].status = PosixMmapReadableFile::Read(reqs[i].offset, reqs[i].n,
+                                                        &reqs[i].result, reqs[i].scratch);
+            if (result.ok() && !reqs[i].status.ok())
+            {
+                result = reqs[i].status;
+            }
+        }
+        return result;
+    }
 };
 
 class PosixWritableFile : public WritableFile
@@ -333,23 +818,575 @@ public:
                 close(fd);
             }
         }
-        return s;
+        return s;
+    }
+
+    virtual Status Sync()
+    {
+        // Ensure new files referred to by the manifest are in the filesystem.
+        Status s = SyncDirIfManifest();
+        if (!s.ok())
+        {
+            return s;
+        }
+        if (fflush_unlocked(file_) != 0 ||
+            fdatasync(fileno(file_)) != 0)
+        {
+            s = Status::IOError(filename_, strerror(errno));
+        }
+        return s;
+    }
+};
+
+// WritableFile that writes behind the caller through its own io_uring.
+// Appends fill one of kBuffers page-aligned buffers; a full buffer, or the
+// current one on Flush() when no write is in flight, is written at its
+// file offset while the caller goes on.  An fdatasync is submitted once
+// every write it has to cover completed.  SyncAsync() calls made while a
+// sync is running share the next one.
+//
+// A reaper thread submits the prepared entries, takes the completions and
+// runs the SyncAsync() callbacks.  Callers only prepare entries and wake
+// it through an eventfd: the kernel cancels the requests of a thread that
+// exits, and callers may exit while their writes are in flight.  (The
+// read of the eventfd is always in flight, so IOSQE_IO_DRAIN would hold
+// the syncs back until the next wakeup.)
+class PosixAsyncWritableFile : public WritableFile
+{
+private:
+    enum { kBuffers = 4 };
+    enum { kSyncToken = kBuffers, kStopToken, kWakeToken };  // user_data
+    static const size_t kBufferSize = 1 << 20;
+    // Written bytes not yet synced that start a background sync, and
+    // bytes not yet durable at which Append() waits for the syncs.
+    static const uint64_t kSyncBytes = 4 << 20;
+    static const uint64_t kMaxUnsyncedBytes = 16 << 20;
+
+    struct Buffer
+    {
+        AlignedBuffer data;
+        uint64_t offset;  // File offset of data[0]
+        struct iovec iov;
+        bool busy;        // A write of it is in flight
+    };
+
+    struct Waiter
+    {
+        uint64_t end;     // Bytes that must be durable
+        SyncCallback callback;
+        void* arg;
+    };
+
+    std::string filename_;
+    int fd_;
+    int wake_fd_;                 // eventfd the reaper keeps a read on
+    uint64_t wake_count_;
+    struct iovec wake_iov_;
+    IoUring* ring_;
+    port::Thread reaper_;
+
+    port::Mutex mu_;
+    port::CondVar cv_;            // Signalled on every completion
+    Buffer buffers_[kBuffers];
+    int current_;                 // Buffer taking appends, never busy
+    bool handing_over_;           // A thread is submitting current_
+    uint64_t submitted_;          // Bytes handed to the ring to write
+    uint64_t written_;            // Bytes whose writes all completed
+    uint64_t sync_submitted_;     // End of the last sync asked for
+    bool sync_pending_;           // That sync waits for written_ to reach it
+    uint64_t durable_;            // Bytes known to be durable
+    unsigned in_flight_;          // Writes and syncs not yet completed
+    std::deque<std::pair<int, uint64_t> > writes_;  // Buffer and end of the
+                                                    // writes in flight, in order
+    unsigned prepared_;           // Entries the reaper has yet to submit
+    bool reaper_awake_;           // The reaper submits without a wakeup
+    bool stopping_;               // Close() wants the reaper to return
+    std::deque<uint64_t> syncs_;  // Ends of the syncs in flight
+    std::deque<Waiter> waiters_;  // SyncAsync() calls, in order
+    bool notifying_;              // A thread is running callbacks
+    Status error_;                // First error, returned from then on
+    bool broken_;                 // The ring failed; nothing completes
+
+    // REQUIRES: mu_ must be held
+    struct io_uring_sqe* NextSqe()
+    {
+        // One entry stays free for the read of wake_fd_.
+        while (in_flight_ + 1 >= ring_->entries())
+        {
+            cv_.Wait();
+        }
+        return ring_->GetSqe();
+    }
+
+    // Count the entry just prepared and make sure the reaper submits it.
+    // REQUIRES: mu_ must be held
+    Status SubmitSqe()
+    {
+        if (broken_)
+        {
+            return error_;
+        }
+        in_flight_++;
+        prepared_++;
+        if (!reaper_awake_)
+        {
+            reaper_awake_ = true;
+            Wake();
+        }
+        return Status::OK();
+    }
+
+    // Complete the read the reaper keeps on wake_fd_.
+    // REQUIRES: mu_ must be held
+    void Wake()
+    {
+        uint64_t one = 1;
+        // Fails only if the count would overflow, which the read prevents.
+        ssize_t r = write(wake_fd_, &one, sizeof(one));
+        assert(r == sizeof(one));
+        (void)r;
+    }
+
+    // Queue the read of wake_fd_ that completes on the next Wake().
+    // REQUIRES: mu_ must be held
+    void ArmWake()
+    {
+        struct io_uring_sqe* sqe = ring_->GetSqe();
+        wake_iov_.iov_base = &wake_count_;
+        wake_iov_.iov_len = sizeof(wake_count_);
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = wake_fd_;
+        sqe->addr = reinterpret_cast<uintptr_t>(&wake_iov_);
+        sqe->len = 1;
+        sqe->user_data = kWakeToken;
+        prepared_++;
+    }
+
+    // Write out the current buffer, if it has data, and move on to the next
+    // free one.  No thread appends to the buffer or submits it again while
+    // this has mu_ released.
+    // REQUIRES: mu_ must be held
+    Status SubmitCurrent()
+    {
+        WaitCurrent();
+        if (!error_.ok() || buffers_[current_].data.CurrentSize() == 0)
+        {
+            return error_;
+        }
+        handing_over_ = true;
+        Status s = HandOver();
+        handing_over_ = false;
+        cv_.SignalAll();
+        return s;
+    }
+
+    // REQUIRES: mu_ must be held, handing_over_ is set
+    Status HandOver()
+    {
+        Buffer& b = buffers_[current_];
+        struct io_uring_sqe* sqe = NextSqe();
+        b.iov.iov_base = b.data.BufferStart();
+        b.iov.iov_len = b.data.CurrentSize();
+        sqe->opcode = IORING_OP_WRITEV;
+        sqe->fd = fd_;
+        sqe->addr = reinterpret_cast<uintptr_t>(&b.iov);
+        sqe->len = 1;
+        sqe->off = b.offset;
+        sqe->user_data = current_;
+        b.busy = true;
+        Status s = SubmitSqe();
+        if (!s.ok())
+        {
+            b.busy = false;
+            return s;
+        }
+        submitted_ += b.iov.iov_len;
+        writes_.push_back(std::make_pair(current_, submitted_));
+
+        int next = (current_ + 1) % kBuffers;
+        while (buffers_[next].busy && !broken_)
+        {
+            cv_.Wait();
+        }
+        if (broken_)
+        {
+            return error_;
+        }
+        current_ = next;
+        buffers_[current_].data.Clear();
+        buffers_[current_].offset = submitted_;
+
+        if (submitted_ - sync_submitted_ >= kSyncBytes)
+        {
+            s = SubmitSync();
+        }
+        return s;
+    }
+
+    // Wait for another thread to finish handing over the current buffer.
+    // REQUIRES: mu_ must be held
+    void WaitCurrent()
+    {
+        while (handing_over_ && error_.ok())
+        {
+            cv_.Wait();
+        }
+    }
+
+    // Ask for everything submitted so far to be made durable.  The sync
+    // goes to the ring once the writes before it completed.
+    // REQUIRES: mu_ must be held
+    Status SubmitSync()
+    {
+        sync_submitted_ = submitted_;
+        sync_pending_ = true;
+        return IssueSync();
+    }
+
+    // REQUIRES: mu_ must be held
+    Status IssueSync()
+    {
+        if (!sync_pending_ || written_ < sync_submitted_)
+        {
+            return Status::OK();
+        }
+        struct io_uring_sqe* sqe = NextSqe();
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->fd = fd_;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        sqe->user_data = kSyncToken;
+        syncs_.push_back(written_);
+        Status s = SubmitSqe();
+        if (!s.ok())
+        {
+            syncs_.pop_back();
+            return s;
+        }
+        sync_pending_ = false;
+        return s;
+    }
+
+    // Finish a short write synchronously.  No sync covering it is issued
+    // before it returns.
+    // REQUIRES: mu_ must not be held, b is busy
+    Status FinishWrite(const Buffer& b, size_t written)
+    {
+        const char* p = b.data.BufferStart() + written;
+        size_t left = b.data.CurrentSize() - written;
+        uint64_t offset = b.offset + written;
+        while (left > 0)
+        {
+            ssize_t r = pwrite(fd_, p, left, static_cast<off_t>(offset));
+            if (r < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return PosixError(filename_, errno);
+            }
+            p += r;
+            left -= r;
+            offset += r;
+        }
+        return Status::OK();
+    }
+
+    // The ring cannot be used any more: fail everything waiting on it.
+    // REQUIRES: mu_ must be held
+    void Break(const Status& s)
+    {
+        broken_ = true;
+        in_flight_ = 0;
+        SetError(s);
+        Notify();
+        cv_.SignalAll();
+    }
+
+    // Body of the reaper thread
+    void Reap()
+    {
+        bool stop = false;
+        bool wake_armed = true;
+        MutexLock l(&mu_);
+        while (!stop || wake_armed)
+        {
+            if (prepared_ > 0)
+            {
+                int r = ring_->Submit();
+                if (r >= 0)
+                {
+                    prepared_ -= std::min(prepared_, static_cast<unsigned>(r));
+                }
+                else if (r != -EBUSY && r != -EAGAIN)
+                {
+                    Break(PosixError(filename_, -r));
+                    return;
+                }
+                // On EBUSY the completions below make room to try again.
+            }
+            reaper_awake_ = (prepared_ > 0);
+
+            struct io_uring_cqe* cqe;
+            mu_.Unlock();
+            int r = ring_->GetCqe(&cqe, true);
+            mu_.Lock();
+            reaper_awake_ = true;
+            if (r < 0)
+            {
+                Break(PosixError(filename_, -r));
+                return;
+            }
+            uint64_t token = cqe->user_data;
+            int res = cqe->res;
+            ring_->SeenCqe();
+            if (token == kStopToken)
+            {
+                stop = true;
+                continue;
+            }
+            if (token == kWakeToken)
+            {
+                wake_armed = false;
+                if (res < 0)
+                {
+                    Break(PosixError(filename_, -res));
+                    return;
+                }
+                if (!stopping_)
+                {
+                    ArmWake();
+                    wake_armed = true;
+                }
+                continue;
+            }
+
+            if (token < kBuffers && res >= 0 &&
+                static_cast<size_t>(res) < buffers_[token].data.CurrentSize())
+            {
+                // The buffer stays busy meanwhile; the producers need not wait.
+                mu_.Unlock();
+                Status s = FinishWrite(buffers_[token], res);
+                mu_.Lock();
+                SetError(s);
+            }
+            in_flight_--;
+            if (token < kBuffers)
+            {
+                Buffer& b = buffers_[token];
+                if (res < 0)
+                {
+                    SetError(PosixError(filename_, -res));
+                }
+                b.busy = false;
+                while (!writes_.empty() && !buffers_[writes_.front().first].busy)
+                {
+                    written_ = writes_.front().second;
+                    writes_.pop_front();
+                }
+                IssueSync();
+            }
+            else
+            {
+                uint64_t end = syncs_.front();
+                syncs_.pop_front();
+                if (res < 0)
+                {
+                    SetError(PosixError(filename_, -res));
+                }
+                else if (error_.ok())
+                {
+                    durable_ = std::max(durable_, end);
+                }
+                // One sync for every caller that came while it ran
+                if (error_.ok() && syncs_.empty() && !sync_pending_ &&
+                    !waiters_.empty() && waiters_.back().end > sync_submitted_)
+                {
+                    SubmitSync();
+                }
+            }
+            Notify();
+            cv_.SignalAll();
+        }
+    }
+
+    // REQUIRES: mu_ must be held
+    void SetError(const Status& s)
+    {
+        if (error_.ok() && !s.ok())
+        {
+            error_ = s;
+        }
+    }
+
+    // Run, in order and without mu_, the callbacks whose data is durable,
+    // or all of them after an error.  Only one thread runs callbacks at a
+    // time; the one running them picks up the waiters that became ready
+    // while it had mu_ released.
+    // REQUIRES: mu_ must be held
+    void Notify()
+    {
+        if (notifying_)
+        {
+            return;
+        }
+        notifying_ = true;
+        while (!waiters_.empty() && (!error_.ok() || waiters_.front().end <= durable_))
+        {
+            Waiter w = waiters_.front();
+            waiters_.pop_front();
+            Status s = error_;
+            mu_.Unlock();
+            (*w.callback)(w.arg, s);
+            mu_.Lock();
+        }
+        notifying_ = false;
+        cv_.SignalAll();
+    }
+
+public:
+    PosixAsyncWritableFile(const std::string& fname, int fd, int wake_fd, IoUring* ring)
+        : filename_(fname), fd_(fd), wake_fd_(wake_fd), wake_count_(0), ring_(ring),
+          cv_(&mu_), current_(0), handing_over_(false), submitted_(0),
+          written_(0), sync_submitted_(0), sync_pending_(false), durable_(0),
+          in_flight_(0), prepared_(0), reaper_awake_(true), stopping_(false),
+          notifying_(false), broken_(false)
+    {
+        for (int i = 0; i < kBuffers; i++)
+        {
+            buffers_[i].data.Alignment(getpagesize());
+            buffers_[i].data.AllocateNewBuffer(kBufferSize);
+            buffers_[i].offset = 0;
+            buffers_[i].busy = false;
+        }
+        ArmWake();
+        reaper_ = port::Thread(&PosixAsyncWritableFile::Reap, this);
+    }
+
+    ~PosixAsyncWritableFile()
+    {
+        if (fd_ >= 0)
+        {
+            // Ignoring any potential errors
+            Close();
+        }
+    }
+
+    virtual Status Append(const Slice& data)
+    {
+        MutexLock l(&mu_);
+        const char* p = data.data();
+        size_t left = data.size();
+        while (left > 0 && error_.ok())
+        {
+            WaitCurrent();
+            Buffer& b = buffers_[current_];
+            size_t n = b.data.Append(p, left);
+            p += n;
+            left -= n;
+            if (b.data.CurrentSize() == b.data.Capacity())
+            {
+                SubmitCurrent();
+            }
+        }
+        // Bound the data that would be lost on a crash.
+        while (error_.ok() && submitted_ - durable_ > kMaxUnsyncedBytes)
+        {
+            cv_.Wait();
+        }
+        return error_;
+    }
+
+    virtual Status Close()
+    {
+        Status result;
+        {
+            MutexLock l(&mu_);
+            SubmitCurrent();
+            while (in_flight_ > 0 || notifying_)
+            {
+                cv_.Wait();
+            }
+            result = error_;
+            if (!broken_)
+            {
+                // The wakeup completes the armed read, which is not armed
+                // again; the reaper returns once it has seen both.
+                stopping_ = true;
+                struct io_uring_sqe* sqe = ring_->GetSqe();
+                sqe->opcode = IORING_OP_NOP;
+                sqe->user_data = kStopToken;
+                prepared_++;
+                reaper_awake_ = true;
+                Wake();
+            }
+        }
+        if (broken_)
+        {
+            // The reaper may never wake up; leave it and its ring be.
+            reaper_.detach();
+        }
+        else
+        {
+            reaper_.join();
+            delete ring_;
+            close(wake_fd_);
+        }
+        ring_ = NULL;
+        if (close(fd_) != 0 && result.ok())
+        {
+            result = PosixError(filename_, errno);
+        }
+        fd_ = -1;
+        return result;
+    }
+
+    // Writes the buffered data if no write is in flight; otherwise the
+    // data goes out with the next write, so Flush() never waits.
+    virtual Status Flush()
+    {
+        MutexLock l(&mu_);
+        if (writes_.empty())
+        {
+            SubmitCurrent();
+        }
+        return error_;
+    }
+
+    virtual Status Sync()
+    {
+        MutexLock l(&mu_);
+        SubmitCurrent();
+        uint64_t target = submitted_;
+        if (error_.ok() && durable_ < target && sync_submitted_ < target)
+        {
+            SubmitSync();
+        }
+        while (error_.ok() && durable_ < target)
+        {
+            cv_.Wait();
+        }
+        return error_;
     }
 
-    virtual Status Sync()
+    virtual void SyncAsync(SyncCallback callback, void* arg)
     {
-        // Ensure new files referred to by the manifest are in the filesystem.
-        Status s = SyncDirIfManifest();
-        if (!s.ok())
+        MutexLock l(&mu_);
+        SubmitCurrent();
+        Waiter w;
+        w.end = submitted_;
+        w.callback = callback;
+        w.arg = arg;
+        waiters_.push_back(w);
+        if (error_.ok() && durable_ < w.end && syncs_.empty())
         {
-            return s;
+            SubmitSync();
         }
-        if (fflush_unlocked(file_) != 0 ||
-            fdatasync(fileno(file_)) != 0)
+        if (!error_.ok() || durable_ >= w.end)
         {
-            s = Status::IOError(filename_, strerror(errno));
+            // Nothing to wait for; earlier callbacks are all done too.
+            Notify();
         }
-        return s;
     }
 };
 
@@ -393,6 +1430,400 @@ public:
     }
 };
 
+static uint64_t MonotonicMicros()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Entry per Schedule() call
+struct BGItem
+{
+    void* arg;
+    void (*function)(void*);
+    uint64_t enqueued;  // MonotonicMicros() when scheduled
+};
+
+// Bounded work-stealing deque of Chase and Lev, with the memory orders of
+// Le et al. except that every store to bottom_ is a release, so a stealer
+// needs no fence to see the slot it reads.  Only the owning worker calls
+// Push() and Pop(), which work at the bottom; any thread may call Steal(),
+// which takes from the top.
+class WorkDeque
+{
+public:
+    WorkDeque() : top_(0), bottom_(0) { }
+
+    // Returns false if the deque is full.
+    bool Push(const BGItem& item)
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed);
+        int64_t t = top_.load(std::memory_order_acquire);
+        if (b - t >= kCapacity)
+        {
+            return false;
+        }
+        Slot& slot = slots_[b & (kCapacity - 1)];
+        slot.arg.store(item.arg, std::memory_order_relaxed);
+        slot.function.store(item.function, std::memory_order_relaxed);
+        slot.enqueued.store(item.enqueued, std::memory_order_relaxed);
+        bottom_.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(BGItem* item)
+    {
+        int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top_.load(std::memory_order_relaxed);
+        if (t > b)
+        {
+            bottom_.store(b + 1, std::memory_order_release);
+            return false;
+        }
+        Load(b, item);
+        if (t < b)
+        {
+            return true;
+        }
+        // Last item: race the stealers for it.
+        bool won = top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                std::memory_order_relaxed);
+        bottom_.store(b + 1, std::memory_order_release);
+        return won;
+    }
+
+    // Returns false if the deque is empty or another thread took the item.
+    bool Steal(BGItem* item)
+    {
+        int64_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b)
+        {
+            return false;
+        }
+        Load(t, item);
+        return top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                            std::memory_order_relaxed);
+    }
+
+    bool Empty() const
+    {
+        return bottom_.load() <= top_.load();
+    }
+
+private:
+    enum { kCapacity = 256 };
+
+    // The fields are atomic because a stealer may read a slot the owner
+    // is refilling; it then loses the race on top_ and drops what it read.
+    struct Slot
+    {
+        std::atomic<void*> arg;
+        std::atomic<void (*)(void*)> function;
+        std::atomic<uint64_t> enqueued;
+    };
+
+    void Load(int64_t index, BGItem* item)
+    {
+        Slot& slot = slots_[index & (kCapacity - 1)];
+        item->arg = slot.arg.load(std::memory_order_relaxed);
+        item->function = slot.function.load(std::memory_order_relaxed);
+        item->enqueued = slot.enqueued.load(std::memory_order_relaxed);
+    }
+
+    std::atomic<int64_t> top_;
+    std::atomic<int64_t> bottom_;
+    Slot slots_[kCapacity];
+};
+
+class PosixThreadPool;
+
+struct PoolWorker
+{
+    PosixThreadPool* pool;
+    int index;
+    WorkDeque deque;
+};
+
+// The pool worker running on this thread, if any.
+static __thread PoolWorker* current_worker = NULL;
+
+// Thread pool behind Env::Schedule() for one priority.  Jobs scheduled
+// by a worker of the pool go to that worker's deque; other jobs go to a
+// shared queue guarded by mu_.  Idle workers take from their own deque
+// first, then from the shared queue, then steal from the other workers.
+class PosixThreadPool
+{
+public:
+    PosixThreadPool();
+
+    void Schedule(void (*function)(void*), void* arg);
+    void SetBackgroundThreads(int number);
+    int GetBackgroundThreads() const
+    {
+        return limit_.load();
+    }
+    unsigned int GetQueueLen() const
+    {
+        return static_cast<unsigned int>(queue_len_.load(std::memory_order_relaxed));
+    }
+    void GetStats(Env::ThreadPoolStats* stats) const;
+
+private:
+    enum { kMaxThreads = 256 };
+
+    // REQUIRES: mu_ must be held
+    void StartThreads();
+    // REQUIRES: mu_ must be held
+    bool HasWork() const;
+
+    bool NextItem(PoolWorker* self, BGItem* item, bool* stolen);
+    void Execute(const BGItem& item, bool stolen);
+
+    // Run() is the body of each worker thread
+    void Run(PoolWorker* self);
+    static void* RunWrapper(void* arg)
+    {
+        PoolWorker* self = reinterpret_cast<PoolWorker*>(arg);
+        self->pool->Run(self);
+        return NULL;
+    }
+
+    port::Mutex mu_;
+    port::CondVar work_cv_;   // Signalled when a job is added
+    port::CondVar limit_cv_;  // Signalled when the thread limit is raised
+    bool started_;
+    std::deque<BGItem> queue_;
+    std::atomic<size_t> queue_size_;  // queue_.size(), readable without mu_
+    std::atomic<int> sleepers_;       // Workers waiting on work_cv_
+    std::atomic<int> limit_;
+    std::atomic<int> num_workers_;
+    std::atomic<PoolWorker*> workers_[kMaxThreads];
+
+    std::atomic<uint64_t> scheduled_;
+    std::atomic<uint64_t> completed_;
+    std::atomic<uint64_t> stolen_;
+    std::atomic<uint64_t> queue_len_;
+    std::atomic<uint64_t> total_wait_micros_;
+    std::atomic<uint64_t> max_wait_micros_;
+    std::atomic<uint64_t> total_run_micros_;
+};
+
+PosixThreadPool::PosixThreadPool()
+    : work_cv_(&mu_),
+      limit_cv_(&mu_),
+      started_(false),
+      queue_size_(0),
+      sleepers_(0),
+      limit_(1),
+      num_workers_(0),
+      scheduled_(0),
+      completed_(0),
+      stolen_(0),
+      queue_len_(0),
+      total_wait_micros_(0),
+      max_wait_micros_(0),
+      total_run_micros_(0)
+{
+    for (int i = 0; i < kMaxThreads; i++)
+    {
+        workers_[i].store(NULL, std::memory_order_relaxed);
+    }
+}
+
+void PosixThreadPool::Schedule(void (*function)(void*), void* arg)
+{
+    BGItem item;
+    item.arg = arg;
+    item.function = function;
+    item.enqueued = MonotonicMicros();
+    scheduled_.fetch_add(1, std::memory_order_relaxed);
+    queue_len_.fetch_add(1, std::memory_order_relaxed);
+
+    PoolWorker* self = current_worker;
+    if (self != NULL && self->pool == this && self->deque.Push(item))
+    {
+        // Pairs with the increment of sleepers_ in Run(): either the
+        // sleeper sees the job or we see the sleeper.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers_.load(std::memory_order_relaxed) > 0)
+        {
+            MutexLock l(&mu_);
+            work_cv_.Signal();
+        }
+        return;
+    }
+
+    MutexLock l(&mu_);
+    if (!started_)
+    {
+        started_ = true;
+        StartThreads();
+    }
+    queue_.push_back(item);
+    queue_size_.store(queue_.size(), std::memory_order_relaxed);
+    if (sleepers_.load(std::memory_order_relaxed) > 0)
+    {
+        work_cv_.Signal();
+    }
+}
+
+void PosixThreadPool::SetBackgroundThreads(int number)
+{
+    number = std::max(1, std::min(number, static_cast<int>(kMaxThreads)));
+    MutexLock l(&mu_);
+    limit_.store(number);
+    if (started_)
+    {
+        StartThreads();
+    }
+    // Idle workers above the new limit park on limit_cv_; the others
+    // go back to waiting for work.
+    work_cv_.SignalAll();
+    limit_cv_.SignalAll();
+}
+
+void PosixThreadPool::StartThreads()
+{
+    int n = num_workers_.load(std::memory_order_relaxed);
+    for (; n < limit_.load(); n++)
+    {
+        PoolWorker* worker = new PoolWorker;
+        worker->pool = this;
+        worker->index = n;
+        workers_[n].store(worker, std::memory_order_release);
+        num_workers_.store(n + 1, std::memory_order_release);
+
+        pthread_t t;
+        PthreadCall("create thread", pthread_create(&t, NULL, &PosixThreadPool::RunWrapper, worker));
+        PthreadCall("detach thread", pthread_detach(t));
+    }
+}
+
+bool PosixThreadPool::HasWork() const
+{
+    if (!queue_.empty())
+    {
+        return true;
+    }
+    int n = num_workers_.load(std::memory_order_acquire);
+    for (int i = 0; i < n; i++)
+    {
+        if (!workers_[i].load(std::memory_order_acquire)->deque.Empty())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool PosixThreadPool::NextItem(PoolWorker* self, BGItem* item, bool* stolen)
+{
+    *stolen = false;
+    if (queue_size_.load(std::memory_order_relaxed) > 0)
+    {
+        MutexLock l(&mu_);
+        if (!queue_.empty())
+        {
+            *item = queue_.front();
+            queue_.pop_front();
+            queue_size_.store(queue_.size(), std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    int n = num_workers_.load(std::memory_order_acquire);
+    for (int i = 1; i < n; i++)
+    {
+        PoolWorker* victim = workers_[(self->index + i) % n].load(std::memory_order_acquire);
+        if (victim->deque.Steal(item))
+        {
+            *stolen = true;
+            return true;
+        }
+    }
+    return false;
+}
+
+void PosixThreadPool::Execute(const BGItem& item, bool stolen)
+{
+    uint64_t start = MonotonicMicros();
+    uint64_t wait = start > item.enqueued ? start - item.enqueued : 0;
+    queue_len_.fetch_sub(1, std::memory_order_relaxed);
+    if (stolen)
+    {
+        stolen_.fetch_add(1, std::memory_order_relaxed);
+    }
+    total_wait_micros_.fetch_add(wait, std::memory_order_relaxed);
+    uint64_t max_wait = max_wait_micros_.load(std::memory_order_relaxed);
+    while (wait > max_wait &&
+           !max_wait_micros_.compare_exchange_weak(max_wait, wait, std::memory_order_relaxed))
+    {
+    }
+
+    (*item.function)(item.arg);
+
+    total_run_micros_.fetch_add(MonotonicMicros() - start, std::memory_order_relaxed);
+    completed_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PosixThreadPool::Run(PoolWorker* self)
+{
+    current_worker = self;
+    BGItem item;
+    bool stolen;
+    while (true)
+    {
+        if (self->deque.Pop(&item))
+        {
+            Execute(item, false);
+            continue;
+        }
+
+        if (self->index >= limit_.load())
+        {
+            // Surplus thread after the limit was lowered; its deque is
+            // empty and stays so until it runs again.
+            MutexLock l(&mu_);
+            while (self->index >= limit_.load())
+            {
+                limit_cv_.Wait();
+            }
+            continue;
+        }
+
+        if (NextItem(self, &item, &stolen))
+        {
+            Execute(item, stolen);
+            continue;
+        }
+
+        // Wait until there is an item that is ready to run
+        MutexLock l(&mu_);
+        sleepers_.fetch_add(1);
+        while (!HasWork() && self->index < limit_.load())
+        {
+            work_cv_.Wait();
+        }
+        sleepers_.fetch_sub(1);
+    }
+}
+
+void PosixThreadPool::GetStats(Env::ThreadPoolStats* stats) const
+{
+    stats->scheduled = scheduled_.load(std::memory_order_relaxed);
+    stats->completed = completed_.load(std::memory_order_relaxed);
+    stats->stolen = stolen_.load(std::memory_order_relaxed);
+    stats->queue_len = queue_len_.load(std::memory_order_relaxed);
+    stats->total_wait_micros = total_wait_micros_.load(std::memory_order_relaxed);
+    stats->max_wait_micros = max_wait_micros_.load(std::memory_order_relaxed);
+    stats->total_run_micros = total_run_micros_.load(std::memory_order_relaxed);
+}
+
 class PosixEnv : public Env
 {
 public:
@@ -420,6 +1851,43 @@ public:
         }
     }
 
+    virtual Status NewMmapSequentialFile(const std::string& fname,
+                                         SequentialFile** result)
+    {
+        uint64_t size;
+        Status s = GetFileSize(fname, &size);
+        if (!s.ok() || size == 0 || !mmap_limit_.Acquire())
+        {
+            // Nothing to map, or too many mappings already
+            return NewSequentialFile(fname, result);
+        }
+
+        *result = NULL;
+        int fd = open(fname.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            s = PosixError(fname, errno);
+        }
+        else
+        {
+            void* base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+            if (base != MAP_FAILED)
+            {
+                *result = new PosixMmapSequentialFile(fname, base, size, &mmap_limit_);
+            }
+            else
+            {
+                s = PosixError(fname, errno);
+            }
+            close(fd);
+        }
+        if (!s.ok())
+        {
+            mmap_limit_.Release();
+        }
+        return s;
+    }
+
     virtual Status NewRandomAccessFile(const std::string& fname,
                                        RandomAccessFile** result)
     {
@@ -476,6 +1944,27 @@ public:
         return s;
     }
 
+    virtual Status NewAsyncWritableFile(const std::string& fname,
+                                        WritableFile** result)
+    {
+        int fd = open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            *result = NULL;
+            return PosixError(fname, errno);
+        }
+        IoUring* ring = IoUring::Create(kIoUringDepth);
+        int wake_fd = ring == NULL ? -1 : eventfd(0, EFD_CLOEXEC);
+        if (wake_fd < 0)
+        {
+            delete ring;
+            close(fd);
+            return NewWritableFile(fname, result);
+        }
+        *result = new PosixAsyncWritableFile(fname, fd, wake_fd, ring);
+        return Status::OK();
+    }
+
     virtual Status NewAppendableFile(const std::string& fname,
                                      WritableFile** result)
     {
@@ -616,7 +2105,35 @@ public:
         return result;
     }
 
-    virtual void Schedule(void (*function)(void*), void* arg);
+    virtual void Schedule(void (*function)(void*), void* arg, Priority pri = LOW)
+    {
+        assert(pri >= LOW && pri < TOTAL);
+        pools_[pri].Schedule(function, arg);
+    }
+
+    virtual void SetBackgroundThreads(int number, Priority pri = LOW)
+    {
+        assert(pri >= LOW && pri < TOTAL);
+        pools_[pri].SetBackgroundThreads(number);
+    }
+
+    virtual int GetBackgroundThreads(Priority pri = LOW)
+    {
+        assert(pri >= LOW && pri < TOTAL);
+        return pools_[pri].GetBackgroundThreads();
+    }
+
+    virtual unsigned int GetThreadPoolQueueLen(Priority pri = LOW) const
+    {
+        assert(pri >= LOW && pri < TOTAL);
+        return pools_[pri].GetQueueLen();
+    }
+
+    virtual void GetThreadPoolStats(Priority pri, ThreadPoolStats* stats) const
+    {
+        assert(pri >= LOW && pri < TOTAL);
+        pools_[pri].GetStats(stats);
+    }
 
     virtual void StartThread(void (*function)(void* arg), void* arg);
 
@@ -674,37 +2191,7 @@ public:
     }
 
 private:
-    void PthreadCall(const char* label, int result)
-    {
-        if (result != 0)
-        {
-            fprintf(stderr, "pthread %s: %s\n", label, strerror(result));
-            abort();
-        }
-    }
-
-    // BGThread() is the body of the background thread
-    void BGThread();
-    static void* BGThreadWrapper(void* arg)
-    {
-        reinterpret_cast<PosixEnv*>(arg)->BGThread();
-        return NULL;
-    }
-
-    pthread_mutex_t mu_;
-    pthread_cond_t bgsignal_;
-    pthread_t bgthread_;
-    bool started_bgthread_;
-
-    // Entry per Schedule() call
-    struct BGItem
-    {
-        void* arg;
-        void (*function)(void*);
-    };
-    typedef std::deque<BGItem> BGQueue;
-    BGQueue queue_;
-
+    PosixThreadPool pools_[TOTAL];
     PosixLockTable locks_;
     Limiter mmap_limit_;
     Limiter fd_limit_;
@@ -748,60 +2235,9 @@ static intptr_t MaxOpenFiles()
 }
 
 PosixEnv::PosixEnv()
-    : started_bgthread_(false),
-      mmap_limit_(MaxMmaps()),
+    : mmap_limit_(MaxMmaps()),
       fd_limit_(MaxOpenFiles())
 {
-    PthreadCall("mutex_init", pthread_mutex_init(&mu_, NULL));
-    PthreadCall("cvar_init", pthread_cond_init(&bgsignal_, NULL));
-}
-
-void PosixEnv::Schedule(void (*function)(void*), void* arg)
-{
-    PthreadCall("lock", pthread_mutex_lock(&mu_));
-
-    // Start background thread if necessary
-    if (!started_bgthread_)
-    {
-        started_bgthread_ = true;
-        PthreadCall(
-            "create thread",
-            pthread_create(&bgthread_, NULL,  &PosixEnv::BGThreadWrapper, this));
-    }
-
-    // If the queue is currently empty, the background thread may currently be
-    // waiting.
-    if (queue_.empty())
-    {
-        PthreadCall("signal", pthread_cond_signal(&bgsignal_));
-    }
-
-    // Add to priority queue
-    queue_.push_back(BGItem());
-    queue_.back().function = function;
-    queue_.back().arg = arg;
-
-    PthreadCall("unlock", pthread_mutex_unlock(&mu_));
-}
-
-void PosixEnv::BGThread()
-{
-    while (true)
-    {
-        // Wait until there is an item that is ready to run
-        PthreadCall("lock", pthread_mutex_lock(&mu_));
-        while (queue_.empty())
-        {
-            PthreadCall("wait", pthread_cond_wait(&bgsignal_, &mu_));
-        }
-
-        void (*function)(void*) = queue_.front().function;
-        void* arg = queue_.front().arg;
-        queue_.pop_front();
-
-        PthreadCall("unlock", pthread_mutex_unlock(&mu_));
-        (*function)(arg);
-    }
 }
 
 namespace {
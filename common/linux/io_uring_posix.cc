@@ -0,0 +1,185 @@
+
+#include "linux/io_uring_posix.h"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+IoUring::IoUring()
+    : fd_(-1),
+      sq_ring_(MAP_FAILED),
+      sq_ring_size_(0),
+      cq_ring_(MAP_FAILED),
+      cq_ring_size_(0),
+      sqes_(static_cast<struct io_uring_sqe*>(MAP_FAILED)),
+      sqes_size_(0),
+      sqe_head_(0),
+      sqe_tail_(0)
+{
+}
+
+IoUring::~IoUring()
+{
+    if (sqes_ != MAP_FAILED)
+    {
+        munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_)
+    {
+        munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_ != MAP_FAILED)
+    {
+        munmap(sq_ring_, sq_ring_size_);
+    }
+    if (fd_ >= 0)
+    {
+        close(fd_);
+    }
+}
+
+IoUring* IoUring::Create(unsigned entries)
+{
+#ifdef __NR_io_uring_setup
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &p));
+    if (fd < 0)
+    {
+        return NULL;
+    }
+
+    IoUring* ring = new IoUring;
+    ring->fd_ = fd;
+    ring->sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (ring->cq_ring_size_ > ring->sq_ring_size_)
+        {
+            ring->sq_ring_size_ = ring->cq_ring_size_;
+        }
+        ring->cq_ring_size_ = ring->sq_ring_size_;
+    }
+    ring->sq_ring_ = mmap(NULL, ring->sq_ring_size_, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring_ == MAP_FAILED)
+    {
+        delete ring;
+        return NULL;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        ring->cq_ring_ = ring->sq_ring_;
+    }
+    else
+    {
+        ring->cq_ring_ = mmap(NULL, ring->cq_ring_size_, PROT_READ | PROT_WRITE,
+                              MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring_ == MAP_FAILED)
+        {
+            delete ring;
+            return NULL;
+        }
+    }
+    ring->sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes_ = static_cast<struct io_uring_sqe*>(
+                      mmap(NULL, ring->sqes_size_, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES));
+    if (ring->sqes_ == MAP_FAILED)
+    {
+        delete ring;
+        return NULL;
+    }
+
+    char* sq = static_cast<char*>(ring->sq_ring_);
+    ring->sq_head_ = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+    ring->sq_tail_ = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+    ring->sq_array_ = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+    ring->sq_mask_ = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+    ring->sq_entries_ = p.sq_entries;
+
+    char* cq = static_cast<char*>(ring->cq_ring_);
+    ring->cq_head_ = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+    ring->cq_tail_ = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+    ring->cq_mask_ = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+    ring->cqes_ = reinterpret_cast<struct io_uring_cqe*>(cq + p.cq_off.cqes);
+    return ring;
+#else
+    return NULL;
+#endif
+}
+
+struct io_uring_sqe* IoUring::GetSqe()
+{
+    unsigned head = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (sqe_tail_ - head >= sq_entries_)
+    {
+        return NULL;
+    }
+    struct io_uring_sqe* sqe = &sqes_[sqe_tail_ & sq_mask_];
+    sqe_tail_++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int IoUring::Enter(unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    int r;
+    do
+    {
+        r = static_cast<int>(syscall(__NR_io_uring_enter, fd_, to_submit, min_complete,
+                                     flags, NULL, 0));
+    } while (r < 0 && errno == EINTR);
+    return r < 0 ? -errno : r;
+}
+
+int IoUring::Submit(unsigned wait_nr)
+{
+    // Publish the prepared entries, then tell the kernel about them and
+    // about any earlier ones it did not consume.
+    unsigned tail = *sq_tail_;
+    while (sqe_head_ != sqe_tail_)
+    {
+        sq_array_[tail & sq_mask_] = sqe_head_ & sq_mask_;
+        tail++;
+        sqe_head_++;
+    }
+    __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+    unsigned pending = tail - __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE);
+    if (pending == 0 && wait_nr == 0)
+    {
+        return 0;
+    }
+    return Enter(pending, wait_nr, wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0);
+}
+
+int IoUring::GetCqe(struct io_uring_cqe** cqe, bool wait)
+{
+    while (true)
+    {
+        unsigned head = *cq_head_;
+        if (head != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE))
+        {
+            *cqe = &cqes_[head & cq_mask_];
+            return 0;
+        }
+        if (!wait)
+        {
+            return -EAGAIN;
+        }
+        int r = Enter(0, 1, IORING_ENTER_GETEVENTS);
+        if (r < 0)
+        {
+            return r;
+        }
+    }
+}
+
+void IoUring::SeenCqe()
+{
+    __atomic_store_n(cq_head_, *cq_head_ + 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,73 @@
+
+// A minimal io_uring submission/completion ring, driven through the raw
+// system calls so that liburing is not needed.  Used by the posix Env to
+// keep several reads or writes in flight from one thread.
+
+#ifndef COMMON_LINUX_IO_URING_POSIX_H_
+#define COMMON_LINUX_IO_URING_POSIX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+class IoUring
+{
+public:
+    // Return a ring with room for "entries" submissions, or NULL if the
+    // kernel lacks io_uring or the process may not use it.
+    static IoUring* Create(unsigned entries);
+
+    ~IoUring();
+
+    // Number of submissions the ring can hold.
+    unsigned entries() const { return sq_entries_; }
+
+    // Return a zeroed submission entry to fill in, or NULL if all of them
+    // are already prepared and not yet submitted.
+    struct io_uring_sqe* GetSqe();
+
+    // Hand the prepared entries to the kernel and, if "wait_nr" > 0, wait
+    // until that many completions are available.  Returns the number of
+    // entries submitted, or -errno.
+    int Submit(unsigned wait_nr = 0);
+
+    // Store the oldest completion in *cqe, waiting for one if "wait" is
+    // set.  Returns 0, -EAGAIN if none is ready and "wait" is not set, or
+    // another -errno.  The entry must be released with SeenCqe().
+    int GetCqe(struct io_uring_cqe** cqe, bool wait);
+
+    // Release the completion returned by GetCqe().
+    void SeenCqe();
+
+private:
+    IoUring();
+
+    int Enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+
+    int fd_;
+    void* sq_ring_;
+    size_t sq_ring_size_;
+    void* cq_ring_;
+    size_t cq_ring_size_;
+    struct io_uring_sqe* sqes_;
+    size_t sqes_size_;
+
+    unsigned* sq_head_;
+    unsigned* sq_tail_;
+    unsigned* sq_array_;
+    unsigned sq_mask_;
+    unsigned sq_entries_;
+    unsigned sqe_head_;  // Entries in [sqe_head_, sqe_tail_) are prepared
+    unsigned sqe_tail_;  // but not yet published to the kernel
+
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    struct io_uring_cqe* cqes_;
+
+    // No copying allowed
+    IoUring(const IoUring&);
+    void operator=(const IoUring&);
+};
+
+#endif  // COMMON_LINUX_IO_URING_POSIX_H_
@@ -13,15 +13,39 @@
 #include <string.h>
 #include "port.h"
 
+// With gcc the kernels carry their own target attributes and are picked
+// by the cpu at runtime, no -msse4.2 is needed for the file.
+#if !defined(PLATFORM_POSIX_SSE) && defined(__GNUC__) && defined(__x86_64__)
+    #define PLATFORM_POSIX_SSE 1
+#endif
+
 #if defined(PLATFORM_POSIX_SSE)
 
     #if defined(_MSC_VER)
         #include <intrin.h>
-    #elif defined(__GNUC__) && defined(__SSE4_2__)
-        #include <nmmintrin.h>
+    #elif defined(__GNUC__)
+        #include <immintrin.h>
         #include <cpuid.h>
     #endif
 
+    #if defined(__GNUC__)
+        #define CRC32C_TARGET __attribute__((target("sse4.2")))
+        #define CRC32C_TARGET_PCLMUL __attribute__((target("sse4.2,pclmul")))
+    #else
+        #define CRC32C_TARGET
+        #define CRC32C_TARGET_PCLMUL
+    #endif
+
+    // Three crc32 streams interleaved, merged with a carry-less multiply
+    #if defined(_M_X64) || defined(__x86_64__)
+        #define CRC32C_INTERLEAVE 1
+    #endif
+
+    // 4 x 512 bits folded per step, gcc only
+    #if defined(__GNUC__) && defined(__x86_64__)
+        #define CRC32C_VPCLMUL 1
+    #endif
+
 #endif  // defined(PLATFORM_POSIX_SSE)
 
 namespace port {
@@ -57,28 +81,202 @@ static inline bool HaveSSE42()
     return (cpu_info[2] & (1 << 20)) != 0;
 #elif defined(__GNUC__)
     unsigned int eax, ebx, ecx, edx;
-    __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+    {
+        return false;
+    }
     return (ecx & (1 << 20)) != 0;
 #else
     return false;
 #endif
 }
 
-#endif  // defined(PLATFORM_POSIX_SSE)
+static inline bool HavePCLMUL()
+{
+#if defined(_MSC_VER)
+    int cpu_info[4];
+    __cpuid(cpu_info, 1);
+    return (cpu_info[2] & (1 << 1)) != 0;
+#elif defined(__GNUC__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0)
+    {
+        return false;
+    }
+    return (ecx & (1 << 1)) != 0;
+#else
+    return false;
+#endif
+}
 
-// For further improvements see Intel publication at:
-// http://download.intel.com/design/intarch/papers/323405.pdf
-uint32_t AcceleratedCRC32C(uint32_t crc, const char* buf, size_t size)
+// AVX-512 also needs the OS to save the zmm registers, which
+// __builtin_cpu_supports() checks
+static inline bool HaveVPCLMUL()
 {
-#if !defined(PLATFORM_POSIX_SSE)
-    return 0;
+#if defined(CRC32C_VPCLMUL)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("vpclmulqdq");
 #else
-    static bool have = HaveSSE42();
-    if (!have)
+    return false;
+#endif
+}
+
+#if defined(CRC32C_INTERLEAVE)
+
+// x^n mod P in the bit-reflected form of the crc32 instruction, bit 31 is
+// x^0.  Only used to set up the constants below.
+static uint32_t XPowModP(uint64_t n)
+{
+    uint32_t r = 0x80000000u;
+    while (n-- > 0)
     {
-        return 0;
+        r = (r & 1) ? ((r >> 1) ^ 0x82f63b78u) : (r >> 1);
+    }
+    return r;
+}
+
+// Bytes per stream in a round of the interleaved kernel, long rounds for
+// the bulk, short ones for the rest
+static const size_t kLongStream = 2048;
+static const size_t kShortStream = 256;
+
+// Bytes folded per step of the VPCLMUL kernel
+static const size_t kFoldBlock = 256;
+
+struct CRC32CConstants
+{
+    // Appending n zero bytes to a crc multiplies it by x^(8n); with
+    // ShiftCRC() the multiplier is x^(8n - 33)
+    uint64_t long_shift;
+    uint64_t short_shift;
+
+    // Fold a 128-bit lane kFoldBlock bytes ahead: low qword by
+    // x^(d + 31), high qword by x^(d - 33), d = 8 * kFoldBlock
+    uint64_t fold_low;
+    uint64_t fold_high;
+
+    CRC32CConstants()
+        : long_shift(XPowModP(8 * kLongStream - 33)),
+          short_shift(XPowModP(8 * kShortStream - 33)),
+          fold_low(XPowModP(8 * kFoldBlock + 31)),
+          fold_high(XPowModP(8 * kFoldBlock - 33))
+    {
+    }
+};
+
+// Set up on first use, crcs may be taken by static initializers
+static const CRC32CConstants& Constants()
+{
+    static const CRC32CConstants constants;
+    return constants;
+}
+
+// crc * x^(8n) mod P for the shift constant of n bytes: the 63-bit product
+// is reduced by the crc32 instruction, which multiplies by x^32 on the way
+static inline CRC32C_TARGET_PCLMUL uint64_t ShiftCRC(uint64_t crc, uint64_t shift)
+{
+    const __m128i product = _mm_clmulepi64_si128(_mm_cvtsi64_si128(static_cast<int64_t>(crc)),
+                            _mm_cvtsi64_si128(static_cast<int64_t>(shift)), 0x00);
+    return _mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(product)));
+}
+
+// Three independent crc32 chains hide the 3 cycle latency of the
+// instruction, the chains of a round are merged with ShiftCRC().
+static CRC32C_TARGET_PCLMUL uint64_t CRC32CInterleaved(uint64_t l, const uint8_t** pp, const uint8_t* e)
+{
+    const CRC32CConstants& k = Constants();
+    const uint8_t* p = *pp;
+
+#define ROUND(stream, shift) do {                                   \
+        uint64_t l1 = 0;                                            \
+        uint64_t l2 = 0;                                            \
+        const uint8_t* end = p + (stream);                          \
+        while (p != end)                                            \
+        {                                                           \
+            l = _mm_crc32_u64(l, LE_LOAD64(p));                     \
+            l1 = _mm_crc32_u64(l1, LE_LOAD64(p + (stream)));        \
+            l2 = _mm_crc32_u64(l2, LE_LOAD64(p + 2 * (stream)));    \
+            p += 8;                                                 \
+        }                                                           \
+        p += 2 * (stream);                                          \
+        l = ShiftCRC(ShiftCRC(l, (shift)) ^ l1, (shift)) ^ l2;      \
+    } while (0)
+
+    while (static_cast<size_t>(e - p) >= 3 * kLongStream)
+    {
+        ROUND(kLongStream, k.long_shift);
     }
+    while (static_cast<size_t>(e - p) >= 3 * kShortStream)
+    {
+        ROUND(kShortStream, k.short_shift);
+    }
+#undef ROUND
+
+    *pp = p;
+    return l;
+}
+
+#endif  // defined(CRC32C_INTERLEAVE)
 
+#if defined(CRC32C_VPCLMUL)
+
+// Folds the data into four zmm registers, kFoldBlock bytes per step, and
+// reduces the last 256 bytes of state with the crc32 instruction.  The
+// crc so far is xor-ed into the first bytes, as the instruction does not
+// condition its input.
+__attribute__((target("avx512f,vpclmulqdq,sse4.2")))
+static uint64_t CRC32CFold(uint64_t l, const uint8_t** pp, const uint8_t* e)
+{
+    const CRC32CConstants& constants = Constants();
+    const uint8_t* p = *pp;
+    const int64_t high = static_cast<int64_t>(constants.fold_high);
+    const int64_t low = static_cast<int64_t>(constants.fold_low);
+    const __m512i k = _mm512_set_epi64(high, low, high, low, high, low, high, low);
+
+    __m512i x0 = _mm512_loadu_si512(p);
+    __m512i x1 = _mm512_loadu_si512(p + 64);
+    __m512i x2 = _mm512_loadu_si512(p + 128);
+    __m512i x3 = _mm512_loadu_si512(p + 192);
+    x0 = _mm512_xor_si512(x0, _mm512_inserti32x4(_mm512_setzero_si512(),
+                          _mm_cvtsi32_si128(static_cast<int>(l)), 0));
+    p += kFoldBlock;
+
+#define FOLD(x, offset) do {                                        \
+        x = _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x, k, 0x00),     \
+                                      _mm512_clmulepi64_epi128(x, k, 0x11),     \
+                                      _mm512_loadu_si512(p + (offset)), 0x96);  \
+    } while (0)
+
+    while (static_cast<size_t>(e - p) >= kFoldBlock)
+    {
+        FOLD(x0, 0);
+        FOLD(x1, 64);
+        FOLD(x2, 128);
+        FOLD(x3, 192);
+        p += kFoldBlock;
+    }
+#undef FOLD
+
+    uint64_t state[kFoldBlock / 8] __attribute__((aligned(64)));
+    _mm512_store_si512(state, x0);
+    _mm512_store_si512(state + 8, x1);
+    _mm512_store_si512(state + 16, x2);
+    _mm512_store_si512(state + 24, x3);
+
+    l = 0;
+    for (size_t i = 0; i < kFoldBlock / 8; i++)
+    {
+        l = _mm_crc32_u64(l, state[i]);
+    }
+
+    *pp = p;
+    return l;
+}
+
+#endif  // defined(CRC32C_VPCLMUL)
+
+static CRC32C_TARGET uint32_t CRC32CSSE42(uint32_t crc, const char* buf, size_t size, int level)
+{
     const uint8_t* p = reinterpret_cast<const uint8_t*>(buf);
     const uint8_t* e = p + size;
     uint32_t l = crc ^ 0xffffffffu;
@@ -109,6 +307,19 @@ uint32_t AcceleratedCRC32C(uint32_t crc, const char* buf, size_t size)
 
         // _mm_crc32_u64 is only available on x64.
 #if defined(_M_X64) || defined(__x86_64__)
+#if defined(CRC32C_VPCLMUL)
+        // Large buffers are folded 256 bytes at a time
+        if (level >= 2 && (e - p) >= 1024)
+        {
+            l = static_cast<uint32_t>(CRC32CFold(l, &p, e));
+        }
+#endif  // defined(CRC32C_VPCLMUL)
+#if defined(CRC32C_INTERLEAVE)
+        if (level >= 1)
+        {
+            l = static_cast<uint32_t>(CRC32CInterleaved(l, &p, e));
+        }
+#endif  // defined(CRC32C_INTERLEAVE)
         // Process 8 bytes at a time
         while ((e - p) >= 8)
         {
@@ -136,6 +347,41 @@ uint32_t AcceleratedCRC32C(uint32_t crc, const char* buf, size_t size)
 #undef STEP4
 #undef STEP1
     return l ^ 0xffffffffu;
+}
+
+// -1: no SSE 4.2, 0: one crc32 chain, 1: interleaved chains (PCLMUL),
+// 2: VPCLMUL folding for large buffers as well
+static int CRC32CLevel()
+{
+    if (!HaveSSE42())
+    {
+        return -1;
+    }
+#if defined(CRC32C_INTERLEAVE)
+    if (HavePCLMUL())
+    {
+        return HaveVPCLMUL() ? 2 : 1;
+    }
+#endif  // defined(CRC32C_INTERLEAVE)
+    return 0;
+}
+
+#endif  // defined(PLATFORM_POSIX_SSE)
+
+// For further improvements see Intel publication at:
+// http://download.intel.com/design/intarch/papers/323405.pdf
+uint32_t AcceleratedCRC32C(uint32_t crc, const char* buf, size_t size)
+{
+#if !defined(PLATFORM_POSIX_SSE)
+    return 0;
+#else
+    static int level = CRC32CLevel();
+    if (level < 0)
+    {
+        return 0;
+    }
+
+    return CRC32CSSE42(crc, buf, size, level);
 #endif  // defined(PLATFORM_POSIX_SSE)
 }
 
@@ -20,9 +20,25 @@ enum RecordType
     // For fragments
     kFirstType = 2,
     kMiddleType = 3,
-    kLastType = 4
+    kLastType = 4,
+
+    // A batch of records stored as one compressed payload, either whole or
+    // as the first fragment followed by kMiddleType/kLastType fragments
+    kBatchFullType = 5,
+    kBatchFirstType = 6
+};
+static const int kMaxRecordType = kBatchFirstType;
+
+// A batch payload is the compression (1 byte), the varint32 length of the
+// uncompressed contents, then the contents compressed: each record as its
+// varint32 length followed by its bytes
+enum BatchCompression
+{
+    kBatchNoCompression = 0,
+    kBatchSnappy = 1,
+    kBatchLZ4 = 2,
+    kBatchZSTD = 3
 };
-static const int kMaxRecordType = kLastType;
 
 static const int kBlockSize = 32768;
 
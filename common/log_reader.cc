@@ -6,9 +6,12 @@
 
 #include "env.h"
 #include "coding.h"
+#include "compression.h"
 #include "crc32c.h"
+#include "mutexlock.h"
 
 #include <stdio.h>
+#include <algorithm>
 
 using namespace log_format;
 
@@ -16,6 +19,81 @@ LogReader::Reporter::~Reporter()
 {
 }
 
+// Uncompress the records of a batch payload into "*contents", returns
+// false if the payload is corrupted.
+static bool DecodeBatch(const Slice& payload, std::string* contents)
+{
+    Slice input = payload;
+    uint32_t raw_size = 0;
+    if (input.empty())
+    {
+        return false;
+    }
+    const unsigned int compression = static_cast<unsigned char>(input[0]);
+    input.remove_prefix(1);
+    if (!GetVarint32(&input, &raw_size))
+    {
+        return false;
+    }
+
+    contents->resize(raw_size);
+    bool ok = false;
+    size_t length = 0;
+    switch (compression)
+    {
+        case kBatchNoCompression:
+            ok = (static_cast<size_t>(input.size()) == raw_size);
+            if (ok)
+            {
+                contents->assign(input.data(), input.size());
+            }
+            break;
+        case kBatchSnappy:
+            ok = port::Snappy_GetUncompressedLength(input.data(), input.size(), &length) &&
+                 length == raw_size &&
+                 port::Snappy_Uncompress(input.data(), input.size(), &(*contents)[0]);
+            break;
+        case kBatchLZ4:
+            ok = port::LZ4_Uncompress(input.data(), input.size(), &(*contents)[0], raw_size);
+            break;
+        case kBatchZSTD:
+            ok = port::ZSTD_Uncompress(input.data(), input.size(), &(*contents)[0], raw_size);
+            break;
+        default:
+            break;
+    }
+    if (!ok)
+    {
+        return false;
+    }
+
+    // Every record must lie inside the contents
+    Slice records(*contents);
+    uint32_t record_size;
+    while (!records.empty())
+    {
+        if (!GetVarint32(&records, &record_size) || record_size > static_cast<size_t>(records.size()))
+        {
+            return false;
+        }
+        records.remove_prefix(record_size);
+    }
+    return true;
+}
+
+// Take the next record of an expanded batch off "*records".
+static bool NextBatchRecord(Slice* records, Slice* record)
+{
+    uint32_t record_size;
+    if (records->empty() || !GetVarint32(records, &record_size))
+    {
+        return false;
+    }
+    *record = Slice(records->data(), record_size);
+    records->remove_prefix(record_size);
+    return true;
+}
+
 LogReader::LogReader(SequentialFile* file, Reporter* reporter, bool checksum,
                uint64_t initial_offset)
     : file_(file),
@@ -29,6 +107,7 @@ LogReader::LogReader(SequentialFile* file, Reporter* reporter, bool checksum,
       initial_offset_(initial_offset),
       resyncing_(initial_offset > 0)
 {
+    file_->Hint(kAccessSequential);
 }
 
 LogReader::~LogReader()
@@ -74,9 +153,16 @@ bool LogReader::ReadRecord(Slice* record, std::string* scratch)
         }
     }
 
+    // The records of a batch share its offset
+    if (NextBatchRecord(&batch_records_, record))
+    {
+        return true;
+    }
+
     scratch->clear();
     record->clear();
     bool in_fragmented_record = false;
+    bool in_batch = false;
     // Record offset of the logical record that we're reading
     // 0 is a dummy value to make compilers happy
     uint64_t prospective_record_offset = 0;
@@ -112,6 +198,7 @@ bool LogReader::ReadRecord(Slice* record, std::string* scratch)
         switch (record_type)
         {
             case kFullType:
+            case kBatchFullType:
                 if (in_fragmented_record)
                 {
                     // Handle bug in earlier versions of log::Writer where
@@ -129,11 +216,23 @@ bool LogReader::ReadRecord(Slice* record, std::string* scratch)
                 }
                 prospective_record_offset = physical_record_offset;
                 scratch->clear();
-                *record = fragment;
+                if (record_type == kBatchFullType)
+                {
+                    if (!ExpandBatch(fragment) || !NextBatchRecord(&batch_records_, record))
+                    {
+                        in_fragmented_record = false;
+                        break;
+                    }
+                }
+                else
+                {
+                    *record = fragment;
+                }
                 last_record_offset_ = prospective_record_offset;
                 return true;
 
             case kFirstType:
+            case kBatchFirstType:
                 if (in_fragmented_record)
                 {
                     // Handle bug in earlier versions of log::Writer where
@@ -152,6 +251,7 @@ bool LogReader::ReadRecord(Slice* record, std::string* scratch)
                 prospective_record_offset = physical_record_offset;
                 scratch->assign(fragment.data(), fragment.size());
                 in_fragmented_record = true;
+                in_batch = (record_type == kBatchFirstType);
                 break;
 
             case kMiddleType:
@@ -175,7 +275,20 @@ bool LogReader::ReadRecord(Slice* record, std::string* scratch)
                 else
                 {
                     scratch->append(fragment.data(), fragment.size());
-                    *record = make_slice(*scratch);
+                    if (in_batch)
+                    {
+                        in_fragmented_record = false;
+                        if (!ExpandBatch(make_slice(*scratch)) ||
+                            !NextBatchRecord(&batch_records_, record))
+                        {
+                            scratch->clear();
+                            break;
+                        }
+                    }
+                    else
+                    {
+                        *record = make_slice(*scratch);
+                    }
                     last_record_offset_ = prospective_record_offset;
                     return true;
                 }
@@ -216,6 +329,19 @@ bool LogReader::ReadRecord(Slice* record, std::string* scratch)
     return false;
 }
 
+bool LogReader::ExpandBatch(const Slice& payload)
+{
+    if (!DecodeBatch(payload, &batch_))
+    {
+        batch_.clear();
+        batch_records_.clear();
+        ReportCorruption(payload.size(), "corrupted batch");
+        return false;
+    }
+    batch_records_ = make_slice(batch_);
+    return true;
+}
+
 uint64_t LogReader::LastRecordOffset()
 {
     return last_record_offset_;
@@ -333,3 +459,377 @@ unsigned int LogReader::ReadPhysicalRecord(Slice* result)
         return type;
     }
 }
+
+// Blocks parsed by a worker at a time.
+static const int kChunkBlocks = 32;
+static const uint64_t kChunkSize = kChunkBlocks * kBlockSize;
+
+// Fragment types besides the RecordType values, as in LogReader
+static const unsigned int kChunkEof = kMaxRecordType + 1;
+static const unsigned int kChunkBadRecord = kMaxRecordType + 2;
+
+// A physical record, or a drop to report ("bytes" > 0 or !status.ok()).
+struct ParallelLogReader::Fragment
+{
+    unsigned int type;
+    uint64_t offset;
+    Slice data;
+    size_t bytes;
+    Status status;
+};
+
+struct ParallelLogReader::Chunk
+{
+    Chunk() : ready(false) { }
+
+    bool ready;
+    std::string backing_store;
+    std::vector<Fragment> fragments;
+};
+
+ParallelLogReader::Handler::~Handler()
+{
+}
+
+ParallelLogReader::ParallelLogReader(RandomAccessFile* file, uint64_t file_size,
+                                     LogReader::Reporter* reporter, bool checksum, int threads)
+    : file_(file),
+      file_size_(file_size),
+      reporter_(reporter),
+      checksum_(checksum),
+      threads_(threads > 1 ? threads : 1),
+      cv_(&mu_),
+      num_chunks_((file_size + kChunkSize - 1) / kChunkSize),
+      next_chunk_(0),
+      consumed_(0),
+      stop_(false)
+{
+    window_.resize(threads_ > 1 ? 2 * threads_ : 1);
+    for (size_t i = 0; i < window_.size(); i++)
+    {
+        window_[i] = new Chunk;
+    }
+    file_->Hint(kAccessSequential);
+}
+
+ParallelLogReader::~ParallelLogReader()
+{
+    for (size_t i = 0; i < window_.size(); i++)
+    {
+        delete window_[i];
+    }
+}
+
+bool ParallelLogReader::DeliverBatch(const Slice& payload, uint64_t offset,
+                                     Handler* handler, std::string* contents)
+{
+    if (!DecodeBatch(payload, contents))
+    {
+        if (reporter_ != NULL)
+        {
+            reporter_->Corruption(payload.size(), Status::Corruption("corrupted batch"));
+        }
+        return true;
+    }
+
+    Slice records = make_slice(*contents);
+    Slice record;
+    while (NextBatchRecord(&records, &record))
+    {
+        if (!handler->Record(record, offset))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+void ParallelLogReader::ParseBlock(const char* block, size_t size, uint64_t offset,
+                                   std::vector<Fragment>* fragments) const
+{
+    // Last read was short, as for LogReader::eof_
+    const bool eof = size < static_cast<size_t>(kBlockSize);
+    Slice buffer(block, size);
+
+    Fragment fragment;
+    fragment.bytes = 0;
+    while (static_cast<size_t>(buffer.size()) >= static_cast<size_t>(kHeaderSize))
+    {
+        const char* header = buffer.data();
+        const uint32_t a = static_cast<uint32_t>(header[4]) & 0xff;
+        const uint32_t b = static_cast<uint32_t>(header[5]) & 0xff;
+        const unsigned int type = header[6];
+        const uint32_t length = a | (b << 8);
+        fragment.offset = offset + (header - block);
+        if (kHeaderSize + length > static_cast<size_t>(buffer.size()))
+        {
+            // The writer died in the middle of the record at the end of
+            // the file, or the length is corrupted
+            if (!eof)
+            {
+                fragment.type = kChunkBadRecord;
+                fragment.bytes = buffer.size();
+                fragment.status = Status::Corruption("bad record length");
+                fragments->push_back(fragment);
+            }
+            return;
+        }
+
+        if (type == kZeroType && length == 0)
+        {
+            // Preallocated region, dropped without a report
+            fragment.type = kChunkBadRecord;
+            fragments->push_back(fragment);
+            return;
+        }
+
+        if (checksum_)
+        {
+            uint32_t expected_crc = crc32c::Unmask(DecodeFixed32(header));
+            uint32_t actual_crc = crc32c::Value(header + 6, 1 + length);
+            if (actual_crc != expected_crc)
+            {
+                // Drop the rest of the block, "length" may be corrupted
+                fragment.type = kChunkBadRecord;
+                fragment.bytes = buffer.size();
+                fragment.status = Status::Corruption("checksum mismatch");
+                fragments->push_back(fragment);
+                return;
+            }
+        }
+
+        fragment.type = type;
+        fragment.data = Slice(header + kHeaderSize, length);
+        fragments->push_back(fragment);
+        buffer.remove_prefix(kHeaderSize + length);
+    }
+}
+
+void ParallelLogReader::ParseChunk(uint64_t index, Chunk* chunk) const
+{
+    const uint64_t offset = index * kChunkSize;
+    const size_t n = static_cast<size_t>(std::min(kChunkSize, file_size_ - offset));
+    chunk->fragments.clear();
+    chunk->backing_store.resize(n);
+
+    // Start pulling in the chunk that will reuse this slot while this
+    // one is parsed.
+    const uint64_t ahead = (index + window_.size()) * kChunkSize;
+    if (ahead < file_size_)
+    {
+        file_->Prefetch(ahead, static_cast<size_t>(std::min(kChunkSize, file_size_ - ahead)));
+    }
+
+    Slice contents;
+    Status s = file_->Read(offset, n, &contents, &chunk->backing_store[0]);
+    if (!s.ok())
+    {
+        Fragment fragment;
+        fragment.type = kChunkEof;
+        fragment.offset = offset;
+        fragment.bytes = n;
+        fragment.status = s;
+        chunk->fragments.push_back(fragment);
+        return;
+    }
+
+    for (size_t pos = 0; pos < static_cast<size_t>(contents.size()); pos += kBlockSize)
+    {
+        const size_t size = std::min(contents.size() - pos, static_cast<size_t>(kBlockSize));
+        ParseBlock(contents.data() + pos, size, offset + pos, &chunk->fragments);
+    }
+
+    // A file cut short while being read ends here
+    if (static_cast<size_t>(contents.size()) < n)
+    {
+        Fragment fragment;
+        fragment.type = kChunkEof;
+        fragment.offset = offset + contents.size();
+        fragment.bytes = 0;
+        chunk->fragments.push_back(fragment);
+    }
+}
+
+void ParallelLogReader::Worker()
+{
+    MutexLock l(&mu_);
+    while (!stop_ && next_chunk_ < num_chunks_)
+    {
+        const uint64_t index = next_chunk_++;
+
+        // Wait for the chunk that used the slot to be delivered
+        while (!stop_ && index >= consumed_ + window_.size())
+        {
+            cv_.Wait();
+        }
+        if (stop_)
+        {
+            break;
+        }
+
+        Chunk* chunk = window_[index % window_.size()];
+        mu_.Unlock();
+        ParseChunk(index, chunk);
+        mu_.Lock();
+        chunk->ready = true;
+        cv_.SignalAll();
+    }
+}
+
+Status ParallelLogReader::ReadAll(Handler* handler)
+{
+    std::vector<port::Thread> workers;
+    if (threads_ > 1)
+    {
+        for (int i = 0; i < threads_ && i < static_cast<int>(num_chunks_); i++)
+        {
+            workers.push_back(port::Thread(&ParallelLogReader::Worker, this));
+        }
+    }
+
+    Status result;
+    std::string scratch;
+    std::string contents;
+    bool in_fragmented_record = false;
+    bool in_batch = false;
+    uint64_t prospective_record_offset = 0;
+    bool done = false;
+    for (uint64_t index = 0; index < num_chunks_ && !done; index++)
+    {
+        Chunk* chunk = window_[index % window_.size()];
+        if (workers.empty())
+        {
+            ParseChunk(index, chunk);
+        }
+        else
+        {
+            MutexLock l(&mu_);
+            while (!chunk->ready)
+            {
+                cv_.Wait();
+            }
+        }
+
+        // Put the records back together, as LogReader::ReadRecord()
+        for (size_t i = 0; i < chunk->fragments.size() && !done; i++)
+        {
+            const Fragment& fragment = chunk->fragments[i];
+            if (reporter_ != NULL && (fragment.bytes > 0 || !fragment.status.ok()))
+            {
+                reporter_->Corruption(fragment.bytes, fragment.status);
+            }
+
+            switch (fragment.type)
+            {
+                case kFullType:
+                case kBatchFullType:
+                    if (in_fragmented_record && !scratch.empty() && reporter_ != NULL)
+                    {
+                        reporter_->Corruption(scratch.size(), Status::Corruption("partial record without end(1)"));
+                    }
+                    in_fragmented_record = false;
+                    scratch.clear();
+                    if (fragment.type == kBatchFullType)
+                    {
+                        done = !DeliverBatch(fragment.data, fragment.offset, handler, &contents);
+                    }
+                    else
+                    {
+                        done = !handler->Record(fragment.data, fragment.offset);
+                    }
+                    break;
+
+                case kFirstType:
+                case kBatchFirstType:
+                    if (in_fragmented_record && !scratch.empty() && reporter_ != NULL)
+                    {
+                        reporter_->Corruption(scratch.size(), Status::Corruption("partial record without end(2)"));
+                    }
+                    prospective_record_offset = fragment.offset;
+                    scratch.assign(fragment.data.data(), fragment.data.size());
+                    in_fragmented_record = true;
+                    in_batch = (fragment.type == kBatchFirstType);
+                    break;
+
+                case kMiddleType:
+                case kLastType:
+                    if (!in_fragmented_record)
+                    {
+                        if (reporter_ != NULL)
+                        {
+                            reporter_->Corruption(fragment.data.size(), Status::Corruption(
+                                fragment.type == kMiddleType ? "missing start of fragmented record(1)"
+                                                             : "missing start of fragmented record(2)"));
+                        }
+                    }
+                    else
+                    {
+                        scratch.append(fragment.data.data(), fragment.data.size());
+                        if (fragment.type == kLastType)
+                        {
+                            in_fragmented_record = false;
+                            if (in_batch)
+                            {
+                                done = !DeliverBatch(make_slice(scratch), prospective_record_offset, handler, &contents);
+                            }
+                            else
+                            {
+                                done = !handler->Record(make_slice(scratch), prospective_record_offset);
+                            }
+                        }
+                    }
+                    break;
+
+                case kChunkEof:
+                    result = fragment.status;
+                    done = true;
+                    break;
+
+                case kChunkBadRecord:
+                    if (in_fragmented_record)
+                    {
+                        if (reporter_ != NULL)
+                        {
+                            reporter_->Corruption(scratch.size(), Status::Corruption("error in middle of record"));
+                        }
+                        in_fragmented_record = false;
+                        scratch.clear();
+                    }
+                    break;
+
+                default:
+                {
+                    char buf[40];
+                    snprintf(buf, sizeof(buf), "unknown record type %u", fragment.type);
+                    if (reporter_ != NULL)
+                    {
+                        reporter_->Corruption(
+                            fragment.data.size() + (in_fragmented_record ? scratch.size() : 0),
+                            Status::Corruption(buf));
+                    }
+                    in_fragmented_record = false;
+                    scratch.clear();
+                    break;
+                }
+            }
+        }
+
+        MutexLock l(&mu_);
+        chunk->ready = false;
+        consumed_++;
+        cv_.SignalAll();
+    }
+
+    // A record left unfinished at the end of the log is ignored, as
+    // LogReader does
+    {
+        MutexLock l(&mu_);
+        stop_ = true;
+        cv_.SignalAll();
+    }
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        workers[i].join();
+    }
+    return result;
+}
@@ -5,9 +5,12 @@
 #include "log_writer.h"
 
 #include <stdint.h>
+#include <vector>
 #include "env.h"
 #include "coding.h"
+#include "compression.h"
 #include "crc32c.h"
+#include "mutexlock.h"
 
 using namespace log_format;
 
@@ -38,6 +41,86 @@ LogWriter::~LogWriter()
 }
 
 Status LogWriter::AddRecord(const Slice& slice)
+{
+    return AddRecords(&slice, 1, false);
+}
+
+Status LogWriter::AddRecords(const Slice* slices, size_t n, bool sync)
+{
+    pending_.clear();
+    for (size_t i = 0; i < n; i++)
+    {
+        FormatRecord(slices[i], false);
+    }
+    return AppendPending(sync);
+}
+
+static bool CompressBatch(BatchCompression compression, const std::string& raw,
+                          std::string* output)
+{
+    switch (compression)
+    {
+        case kBatchSnappy:
+            return port::Snappy_Compress(raw.data(), raw.size(), output);
+        case kBatchLZ4:
+            return port::LZ4_Compress(raw.data(), raw.size(), output);
+        case kBatchZSTD:
+            return port::ZSTD_Compress(raw.data(), raw.size(), output);
+        default:
+            return false;
+    }
+}
+
+Status LogWriter::AddBatch(const Slice* slices, size_t n,
+                           BatchCompression compression, bool sync)
+{
+    raw_.clear();
+    for (size_t i = 0; i < n; i++)
+    {
+        PutVarint32(&raw_, static_cast<uint32_t>(slices[i].size()));
+        raw_.append(slices[i].data(), slices[i].size());
+    }
+
+    // Store the records when compression is not built in or does not help
+    std::string* contents = &compressed_;
+    if (!CompressBatch(compression, raw_, &compressed_) ||
+        compressed_.size() >= raw_.size())
+    {
+        compression = kBatchNoCompression;
+        contents = &raw_;
+    }
+
+    std::string header(1, static_cast<char>(compression));
+    PutVarint32(&header, static_cast<uint32_t>(raw_.size()));
+    contents->insert(0, header);
+
+    pending_.clear();
+    FormatRecord(*contents, true);
+    return AppendPending(sync);
+}
+
+Status LogWriter::AppendPending(bool sync)
+{
+    Status s = dest_->Append(pending_);
+    if (s.ok())
+    {
+        s = sync ? dest_->Sync() : dest_->Flush();
+    }
+
+    // Do not hold on to the memory of an unusually large record
+    if (pending_.capacity() > 4 * kBlockSize)
+    {
+        std::string().swap(pending_);
+    }
+    if (raw_.capacity() > 4 * kBlockSize)
+    {
+        std::string().swap(raw_);
+        std::string().swap(compressed_);
+    }
+    return s;
+}
+
+void LogWriter::FormatRecord(const Slice& slice, bool batch)
 {
     const char* ptr = slice.data();
     size_t left = slice.size();
@@ -45,7 +128,6 @@ Status LogWriter::AddRecord(const Slice& slice)
     // Fragment the record if necessary and emit it.  Note that if slice
     // is empty, we still want to iterate once to emit a single
     // zero-length record
-    Status s;
     bool begin = true;
     do
     {
@@ -58,7 +140,7 @@ Status LogWriter::AddRecord(const Slice& slice)
             {
                 // Fill the trailer (literal below relies on kHeaderSize being 7)
                 assert(kHeaderSize == 7);
-                dest_->Append(Slice("\x00\x00\x00\x00\x00\x00", leftover));
+                pending_.append("\x00\x00\x00\x00\x00\x00", leftover);
             }
             block_offset_ = 0;
         }
@@ -73,11 +155,11 @@ Status LogWriter::AddRecord(const Slice& slice)
         const bool end = (left == fragment_length);
         if (begin && end)
         {
-            type = kFullType;
+            type = batch ? kBatchFullType : kFullType;
         }
         else if (begin)
         {
-            type = kFirstType;
+            type = batch ? kBatchFirstType : kFirstType;
         }
         else if (end)
         {
@@ -88,16 +170,15 @@ Status LogWriter::AddRecord(const Slice& slice)
             type = kMiddleType;
         }
 
-        s = EmitPhysicalRecord(type, ptr, fragment_length);
+        FormatPhysicalRecord(type, ptr, fragment_length);
         ptr += fragment_length;
         left -= fragment_length;
         begin = false;
     }
-    while (s.ok() && left > 0);
-    return s;
+    while (left > 0);
 }
 
-Status LogWriter::EmitPhysicalRecord(RecordType t, const char* ptr, size_t n)
+void LogWriter::FormatPhysicalRecord(RecordType t, const char* ptr, size_t n)
 {
     assert(n <= 0xffff);  // Must fit in two bytes
     assert(block_offset_ + kHeaderSize + n <= kBlockSize);
@@ -113,17 +194,116 @@ Status LogWriter::EmitPhysicalRecord(RecordType t, const char* ptr, size_t n)
     crc = crc32c::Mask(crc);                 // Adjust for storage
     EncodeFixed32(buf, crc);
 
-    // Write the header and the payload
-    Status s = dest_->Append(Slice(buf, kHeaderSize));
-    if (s.ok())
+    // Queue the header and the payload
+    pending_.append(buf, kHeaderSize);
+    pending_.append(ptr, n);
+    block_offset_ += kHeaderSize + n;
+}
+
+// A thread blocked in GroupLogWriter::AddRecord().
+struct GroupLogWriter::Waiter
+{
+    explicit Waiter(port::Mutex* mu)
+        : cv(mu), sync(false), done(false) { }
+
+    port::CondVar cv;
+    Slice record;
+    bool sync;
+    bool done;
+    Status status;
+};
+
+GroupLogWriter::GroupLogWriter(LogWriter* log, bool batch,
+                               BatchCompression compression)
+    : log_(log),
+      batch_(batch),
+      compression_(compression)
+{
+}
+
+GroupLogWriter::~GroupLogWriter()
+{
+    assert(waiters_.empty());
+}
+
+Status GroupLogWriter::AddRecord(const Slice& slice, bool sync)
+{
+    Waiter w(&mu_);
+    w.record = slice;
+    w.sync = sync;
+
+    MutexLock l(&mu_);
+    waiters_.push_back(&w);
+    while (!w.done && &w != waiters_.front())
+    {
+        w.cv.Wait();
+    }
+    if (w.done)
+    {
+        return w.status;
+    }
+
+    // This thread is the leader: take the records queued so far.  Limit the
+    // group so that a small record is not held up too long by large ones.
+    size_t size = w.record.size();
+    size_t max_size = 1 << 20;
+    if (size <= (128 << 10))
+    {
+        max_size = size + (128 << 10);
+    }
+
+    std::vector<Slice> records;
+    records.push_back(w.record);
+    bool need_sync = w.sync;
+    Waiter* last = &w;
+    std::deque<Waiter*>::iterator iter = waiters_.begin();
+    for (++iter; iter != waiters_.end(); ++iter)
     {
-        s = dest_->Append(Slice(ptr, n));
-        if (s.ok())
+        Waiter* next = *iter;
+        size += next->record.size();
+        if (size > max_size)
         {
-            s = dest_->Flush();
+            break;
         }
+
+        records.push_back(next->record);
+        need_sync = need_sync || next->sync;
+        last = next;
+    }
+
+    // The followers stay blocked, their records can be read unlocked
+    mu_.Unlock();
+    Status s;
+    if (batch_ && records.size() > 1)
+    {
+        s = log_->AddBatch(&records[0], records.size(), compression_, need_sync);
+    }
+    else
+    {
+        s = log_->AddRecords(&records[0], records.size(), need_sync);
+    }
+    mu_.Lock();
+
+    while (true)
+    {
+        Waiter* ready = waiters_.front();
+        waiters_.pop_front();
+        if (ready != &w)
+        {
+            ready->status = s;
+            ready->done = true;
+            ready->cv.Signal();
+        }
+        if (ready == last)
+        {
+            break;
+        }
+    }
+
+    // Notify the new head of the queue
+    if (!waiters_.empty())
+    {
+        waiters_.front()->cv.Signal();
     }
-    block_offset_ += kHeaderSize + n;
     return s;
 }
-
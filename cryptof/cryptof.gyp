@@ -8,10 +8,38 @@
 			'target_name': 'crypto_file',
 			'type': 'static_library',
 			'standalone_static_library': 1,
+			'variables': {
+				# compressors of the "LZ4 -> ..." / "ZSTD -> ..." data versions,
+				# without them the frames are stored uncompressed
+				'use_lz4%': 0,
+				'use_zstd%': 0,
+			},
 			'dependencies': [
 				'../template/base.gypi:base',
 				'../common/common.gyp:common',
 			],
+			'conditions': [
+				['use_lz4==1', {
+					'defines': [
+						'LZ4',
+					],
+					'link_settings': {
+						'libraries': [
+							'-llz4',
+						],
+					},
+				}],
+				['use_zstd==1', {
+					'defines': [
+						'ZSTD',
+					],
+					'link_settings': {
+						'libraries': [
+							'-lzstd',
+						],
+					},
+				}],
+			],
 			'configurations': {
 				'Common_Base': {
 					'msvs_configuration_attributes': {
@@ -24,9 +52,12 @@
 				'../include',
 			],
 			'sources': [
+				'./src/checksum.cpp',
+				'./src/compress.cpp',
 				'./src/encode_file.cpp',
 				'./src/decode_file.cpp',
 				'./src/factory.cpp',
+				'./src/parallel.cpp',
 				'./src/utils.cpp',
 			],
 		},
@@ -44,6 +75,8 @@
 					'./include/utils.h',
 					'./include/stream.h',
 					'./include/interface.h',
+					'./include/checksum.h',
+					'./include/compress.h',
 					'./include/factory.h',
 					'./include/encode_file.h',
 					'./include/decode_file.h',
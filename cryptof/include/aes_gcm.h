@@ -0,0 +1,150 @@
+
+#include "interface.h"
+#include "exception.h"
+#include "cryptopp/aes.h"
+#include "cryptopp/gcm.h"
+
+using CryptoPP::AES;
+using CryptoPP::GCM;
+
+// AES-GCM over 4 KB chunks in STREAM construction: chunk i is sealed with the
+// nonce (entry iv || be32(i | last flag)) and carries its own tag, so chunks can
+// be decoded in any order and a corrupt chunk fails on its own. The last chunk
+// has the top bit of the counter set and the stream length (be64) as associated
+// data, so cutting the entry at a chunk or changing its length fails as well.
+class AESGCMCrypto : public Crypto
+{
+public:
+	enum
+	{
+		kChunk  = 4096,
+		kTag    = 16,
+		kIV     = 8,
+		kNonce  = kIV + 4
+	};
+
+	AESGCMCrypto(const Slice& key)
+	  : mKey(key.to_string())
+	  , mBlock(0)
+	  , mLast(~0ull)
+	{
+		mKey.resize(AES::DEFAULT_KEYLENGTH);
+		memset(mLength, 0, sizeof(mLength));
+		memset(mNonce, 0, sizeof(mNonce));
+		mEncoder.SetKeyWithIV((u_char *)mKey.data(), mKey.size(), mNonce, kNonce);
+		mDecoder.SetKeyWithIV((u_char *)mKey.data(), mKey.size(), mNonce, kNonce);
+	}
+
+	virtual int type() const
+	{
+		return static_cast<int>(eCrypto::kAESGCM);
+	}
+
+	virtual const char* name() const
+	{
+		return "AES-GCM";
+	}
+
+	// encode:
+	virtual int encode_length(int len) const
+	{
+		return (len + kChunk - 1) / kChunk * (kChunk + kTag);
+	}
+
+	virtual int encode_outsize() const
+	{
+		return kChunk + kTag;
+	}
+
+	virtual int encode_blocksize() const
+	{
+		return kChunk;
+	}
+
+	virtual void encode(const u_char* input, u_char* output)
+	{
+		const int aad = next_nonce();
+		mEncoder.EncryptAndAuthenticate(output, output + kChunk, kTag, mNonce, kNonce, mLength, aad, input, kChunk);
+	}
+
+	// decode:
+	virtual int decode_length(int len) const
+	{
+		return len / (kChunk + kTag) * kChunk;
+	}
+
+	virtual int decode_outsize() const
+	{
+		return kChunk;
+	}
+
+	virtual int decode_blocksize() const
+	{
+		return kChunk + kTag;
+	}
+
+	virtual void decode(const u_char* input, u_char* output)
+	{
+		const int aad = next_nonce();
+		if (!mDecoder.DecryptAndVerify(output, input + kChunk, kTag, mNonce, kNonce, mLength, aad, input, kChunk))
+		{
+			throw Exception("AES-GCM chunk failed authentication");
+		}
+	}
+
+	// stream:
+	virtual int iv_size() const
+	{
+		return kIV;
+	}
+
+	virtual void set_iv(const u_char* iv, int len)
+	{
+		SMART_ASSERT(len == kIV)("len", len);
+		memcpy(mNonce, iv, kIV);
+	}
+
+	virtual void seek(uint64_t block)
+	{
+		mBlock = block;
+	}
+
+	// without a length no chunk is sealed as the last one, such a stream never decodes
+	virtual void set_length(uint64_t length)
+	{
+		mLast = (length > 0) ? (length - 1) / kChunk : ~0ull;
+		for (int i = 0; i < 8; ++i)
+		{
+			mLength[i] = static_cast<u_char>(length >> (56 - 8 * i));
+		}
+	}
+
+	// the AES key setup is cheap, GCM state is not copied
+	virtual Crypto* clone() const
+	{
+		return new AESGCMCrypto(mKey);
+	}
+
+private:
+	// the nonce of the next chunk, returns the associated data bytes (mLength) it is sealed with
+	int next_nonce()
+	{
+		SMART_ASSERT(mBlock < 0x80000000ull)("block", mBlock);
+		const bool last = (mBlock == mLast);
+		const uint32_t block = static_cast<uint32_t>(mBlock++) | (last ? 0x80000000u : 0);
+		mNonce[kIV + 0] = static_cast<u_char>(block >> 24);
+		mNonce[kIV + 1] = static_cast<u_char>(block >> 16);
+		mNonce[kIV + 2] = static_cast<u_char>(block >> 8);
+		mNonce[kIV + 3] = static_cast<u_char>(block);
+		return last ? static_cast<int>(sizeof(mLength)) : 0;
+	}
+
+private:
+	GCM<AES>::Encryption mEncoder;
+	GCM<AES>::Decryption mDecoder;
+	std::string          mKey;
+	uint64_t             mBlock;
+	uint64_t             mLast;      // chunk sealed as the last one
+	u_char               mLength[8]; // be64 stream length, associated data of the last chunk
+	u_char               mNonce[kNonce];
+};
@@ -43,6 +43,15 @@ public:
 		SMART_ASSERT(mEncodeOut > 0);
 	}
 
+	// blocks have no padding, so a run of them is coded in one call
+	// (the vector kernels of common/base64.cc want long inputs)
+	virtual int encode_blocks(const u_char* input, u_char* output, int nblocks)
+	{
+		const int size = base64_encode((char *)output, (const char *)input, nblocks * encode_blocksize());
+		SMART_ASSERT(size == nblocks * decode_blocksize())("size", size);
+		return size;
+	}
+
 	// decode:
 	virtual int decode_outsize() const
 	{
@@ -65,6 +74,18 @@ public:
 		SMART_ASSERT(mDecodeOut > 0);
 	}
 
+	virtual int decode_blocks(const u_char* input, u_char* output, int nblocks)
+	{
+		const int size = base64_decode((char *)output, (const char *)input, nblocks * decode_blocksize());
+		SMART_ASSERT(size == nblocks * encode_blocksize())("size", size);
+		return size;
+	}
+
+	virtual Crypto* clone() const
+	{
+		return new Base64Crypto();
+	}
+
 private:
 	int mEncodeOut;
 	int mDecodeOut;
@@ -49,6 +49,13 @@ public:
 		mEncoder.ProcessAndXorBlock(input, mXor, output);
 	}
 
+	virtual int encode_blocks(const u_char* input, u_char* output, int nblocks)
+	{
+		const size_t length = integer_cast<size_t>(nblocks) * Blowfish::BLOCKSIZE;
+		mEncoder.AdvancedProcessBlocks(input, nullptr, output, length, CryptoPP::BlockTransformation::BT_AllowParallel);
+		return integer_cast<int>(length);
+	}
+
 	// decode:
 	virtual int decode_length(int len) const
 	{
@@ -70,6 +77,29 @@ public:
 		mDecoder.ProcessAndXorBlock(input, mXor, output);
 	}
 
+	virtual int decode_blocks(const u_char* input, u_char* output, int nblocks)
+	{
+		const size_t length = integer_cast<size_t>(nblocks) * Blowfish::BLOCKSIZE;
+		mDecoder.AdvancedProcessBlocks(input, nullptr, output, length, CryptoPP::BlockTransformation::BT_AllowParallel);
+		return integer_cast<int>(length);
+	}
+
+	virtual Crypto* clone() const
+	{
+		return new BlowfishCrypto(*this);
+	}
+
+private:
+	// clone(): copies the key schedules instead of running the key setup again
+	BlowfishCrypto(const BlowfishCrypto& other)
+		: Crypto()
+		, mEncoder(other.mEncoder)
+		, mDecoder(other.mDecoder)
+		, mKey(other.mKey)
+	{
+		memcpy(mXor, other.mXor, sizeof(mXor));
+	}
+
 private:
 	BlowfishEncryption mEncoder;
 	BlowfishDecryption mDecoder;
@@ -0,0 +1,77 @@
+
+#ifndef _COMPRESS_H_
+#define _COMPRESS_H_
+
+#include "common/slice.h"
+#include "common/noncopyable.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+enum eCompress
+{
+	kNoCompress,
+	kLZ4,    // fast
+	kZSTD,   // better ratio
+	kXpress, // Windows only
+	kCompressMax
+};
+
+// compression stage of a data pipeline ("LZ4 -> AES"), kNoCompress for coders
+inline int compress_type(const Slice& code)
+{
+	if (code.icompare("LZ4") == 0)
+		return kLZ4;
+	else if (code.icompare("ZSTD") == 0)
+		return kZSTD;
+	else if (code.icompare("XPRESS") == 0)
+		return kXpress;
+
+	return kNoCompress;
+}
+
+// the data of a compressed entry is a run of frames, coded by the rest of the
+// pipeline like a plain file:
+//   uint32_t plain size, uint32_t packed size (0: stored as is), packed bytes
+#define FRAME_SIZE   static_cast<int64_t>(1024 * 1024) // plain bytes per frame
+#define FRAME_HEADER static_cast<int64_t>(8)
+
+// append the frame of size (<= FRAME_SIZE) bytes of data to dest, frames the
+// compressor can not shrink (or a build without it) are stored
+void compress_frame(int type, const char* data, int size, std::string& dest);
+
+// cuts the decoded frame stream into frames again and inflates them
+class FrameReader : boost::noncopyable
+{
+public:
+	explicit FrameReader(int type);
+
+	// more of the stream, invalidates the last plain data of next()
+	void append(const char* data, int size);
+
+	// frames ending at or before offset are dropped without inflating them
+	void skip_to(uint64_t offset);
+
+	// plain data of the next complete frame, false until more is appended
+	bool next(Slice& plain);
+
+	// plain offset of the frame returned by next()
+	uint64_t position() const { return mPosition; }
+
+	// plain bytes of all frames read so far
+	uint64_t total() const { return mTotal; }
+
+	// the stream appended so far ends on a frame
+	bool done() const { return mPos == mStream.size(); }
+
+private:
+	int               mType;
+	std::string       mStream;
+	size_t            mPos;
+	std::vector<char> mPlain;
+	uint64_t          mPosition;
+	uint64_t          mTotal;
+	uint64_t          mSkip;
+};
+
+#endif // _COMPRESS_H_
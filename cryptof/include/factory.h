@@ -3,6 +3,7 @@
 #define _FACTORY_H_
 
 #include "utils.h"
+#include "checksum.h"
 #include "common/object_pool.h"
 #include <map>
 #include <string>
@@ -12,6 +13,18 @@
 #define UNUSED_SIZE static_cast<int64_t>(2048)
 #define MAX_BUFSIZE static_cast<int64_t>(32 * 1024 * 1024)
 
+// write blocks covered by one integrity check (crc32c of the encoded data),
+// BLOCKS must be a multiple of it
+#define CHECK_BLOCKS static_cast<int64_t>(1024)
+
+// blocks coded per chunk: BLOCKS, fewer for coders with large blocks so that
+// a chunk stays within MAX_BUFSIZE (always a multiple of CHECK_BLOCKS)
+inline int64_t chunk_blocks(int64_t bsize)
+{
+	const int64_t blocks = MAX_BUFSIZE / bsize / CHECK_BLOCKS * CHECK_BLOCKS;
+	return std::max(CHECK_BLOCKS, std::min(BLOCKS, blocks));
+}
+
 enum eCrypto
 {
 	kAES,
@@ -19,6 +32,7 @@ enum eCrypto
 	kDES,
 	kDES3,
 	kBlowfish,
+	kAESGCM,
 	kMax
 };
 
@@ -38,6 +52,7 @@ inline bool is_vaild_coder(const Slice& code)
 		|| code.icompare("DES") == 0
 		|| code.icompare("Base64") == 0
 		|| code.icompare("Blowfish") == 0
+		|| code.icompare("AES-GCM") == 0
 	)
 	{
 		return true;
@@ -64,12 +79,21 @@ struct CryptoMeta
 	uint64_t mFileEnd;
 	u_char   mMd5Sum[128];
 	int      mMd5SumLength;
+	u_char   mIV[16];     // per-entry nonce of AEAD coders
+	int      mIVLength;
+	int      mSumType;    // eCheckSum of mMd5Sum, kSumMD5 for old archives
+	uint64_t mRawSize;    // plain bytes, 0 for old archives
+	uint64_t mCheckOffset; // crc32c list of the coded data, up to mFileEnd; 0 for old archives
+	uint32_t mCheckBlocks; // write blocks covered by one check
+	uint32_t mCheckCount;
 
 	bool is_vaild() const
 	{
 		return contains(FileDataCrypto, mFileDataVersion)
 			&& contains(FileNameCrypto, mFileNameVersion)
-			&& mFileNameLength >= 0;
+			&& mFileNameLength >= 0
+			&& mIVLength >= 0 && mIVLength <= static_cast<int>(sizeof(mIV))
+			&& mSumType >= kSumMD5 && mSumType < kSumMax;
 	}
 };
 
@@ -82,6 +106,35 @@ inline std::ostream& operator<<(std::ostream& out, const CryptoMeta& meta)
 	return out;
 }
 
+// archive directory (trailer), written on close when EncodeFile::index() is set:
+//   32 '0' bytes    : stops the header scan of this decoder; decoders without
+//                     directory support reject the archive at these bytes
+//   IndexEntry + encoded file name + mCheckCount crc32c, one per entry
+//   IndexFooter     : fixed size, last bytes of the archive
+#define INDEX_MAGIC     "CFINDEX1"
+#define INDEX_STOP_SIZE static_cast<int64_t>(32)
+#define INDEX_TAIL_SIZE static_cast<uint64_t>(256 * 1024) // first read of load()
+
+struct IndexEntry
+{
+	uint64_t   mOffset;     // data offset
+	uint64_t   mFileSize;
+	int        mWriteBSize;
+	int        mNameLength; // encoded file name bytes after the entry
+	uint32_t   mCheckBlocks;
+	uint32_t   mCheckCount; // uint32_t checks after the name
+	CryptoMeta mMeta;
+};
+
+struct IndexFooter
+{
+	char     mMagic[8];
+	uint64_t mIndexOffset;
+	uint64_t mIndexSize;  // stop bytes + entries
+	uint32_t mIndexCrc;   // crc32c of the whole directory
+	uint32_t mCount;
+};
+
 struct FileMeta
 {
 	Slice mName;
@@ -89,6 +142,7 @@ struct FileMeta
 	uint64_t    mOffset;
 	uint64_t    mFileSize;
 	int         mWriteBSize;
+	Slice       mChecks; // crc32c of every CHECK_BLOCKS write blocks, empty for legacy archives
 
 	FileMeta()
 	  : mOffset(0)
@@ -97,6 +151,18 @@ struct FileMeta
 	{
 		memset(&mMeta, 0, sizeof(mMeta));
 	}
+
+	// mFileSize counts the frame stream of compressed entries
+	uint64_t plain_size() const
+	{
+		return (mMeta.mRawSize > 0) ? mMeta.mRawSize : mFileSize;
+	}
+
+	// end of the coded data, the check list sits between it and mFileEnd
+	uint64_t code_end() const
+	{
+		return (mMeta.mCheckOffset > 0) ? mMeta.mCheckOffset : mMeta.mFileEnd;
+	}
 };
 
 inline std::ostream& operator<<(std::ostream& out, const FileMeta& fmeta)
@@ -129,7 +195,14 @@ typedef std::unordered_map<Slice, FileMeta, SliceHash> FileList;
 void encode_filename(std::string& dest, const Slice& filename, const Slice& key, int version);
 void decode_filename(std::string& dest, const Slice& filename, const Slice& key, int version);
 
+// append the checks of data, split into chunk-sized pieces (the last may be shorter)
+void append_checks(std::string& dest, const u_char* data, int size, int chunk);
+
 Crypto* new_coder(const Slice& code, const Slice& key);
 Crypto* new_coder2(const eCrypto& code, const Slice& key);
 
+// like new_coder, but clones a cached prototype per (code, key) so that
+// building a pipeline skips the key setup; thread safe
+Crypto* cached_coder(const Slice& code, const Slice& key);
+
 #endif // _FACTORY_H_
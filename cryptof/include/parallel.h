@@ -0,0 +1,81 @@
+
+#ifndef _PARALLEL_H_
+#define _PARALLEL_H_
+
+#include "factory.h"
+#include "stream.h"
+#include "checksum.h"
+#include "common/channel.h"
+#include "common/noncopyable.h"
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct CodeChunk
+{
+	std::vector<u_char> mInput;  // read() buffer, unused for mapped input
+	std::vector<u_char> mOutput;
+	const u_char*       mData;   // mInput or the mapped file
+	std::string         mChecks; // checks of mOutput, encode only
+	std::string         mSums;   // leaf sums of the plain data, parallel checksums only
+	uint64_t            mSeq;
+	int                 mInSize;
+	int                 mOutSize;
+};
+
+// the coder builds a pipeline per thread and starts its threads for every
+// entry, an entry of a single chunk gains nothing from that: code it serially
+inline bool parallel_worth(uint64_t length, int64_t bsize)
+{
+	return length > static_cast<uint64_t>(bsize * chunk_blocks(bsize));
+}
+
+// reader -> N coder threads -> ordered writer, for the data of one entry:
+// the calling thread writes, every worker owns its CryptoPipeline.
+class ParallelCoder : boost::noncopyable
+{
+public:
+	ParallelCoder(const std::string& desc, const Slice& key, int threads);
+	~ParallelCoder();
+
+	int read_bsize()  const { return mPipes.front()->read_bsize();  }
+	int write_bsize() const { return mPipes.front()->write_bsize(); }
+
+	void set_iv(const Slice& iv);
+	void set_length(uint64_t length);
+
+	// encode length bytes of input, sum is updated with the plain data and
+	// the checks of the encoded data are appended to checks,
+	// returns the plain bytes processed
+	uint64_t encode(InputFileStream& input, uint64_t length, OutputFileStream& output, CheckSum& sum, std::string& checks);
+
+	// decode length bytes of input and keep the first filesize bytes (added to sum),
+	// returns the plain bytes written
+	uint64_t decode(InputFileStream& input, uint64_t length, OutputFileStream& output, uint64_t filesize, CheckSum& sum);
+
+private:
+	uint64_t run(InputFileStream& input, uint64_t length, int chunk, OutputFileStream& output, uint64_t limit, CheckSum& sum, std::string* checks);
+	void read_loop(InputFileStream& input, uint64_t length, int chunk);
+	void work_loop(CryptoPipeline* pipe, bool encode);
+
+private:
+	typedef std::shared_ptr<CryptoPipeline> CryptoPipelinePtr;
+
+	std::vector<CryptoPipelinePtr> mPipes;
+	std::vector<CodeChunk>         mChunks;
+	uint64_t                       mChunkBlocks; // pipeline blocks per chunk
+	int                            mSumLeaf;     // 0 when the checksum is serial
+	Channel<CodeChunk*>            mFree;
+	Channel<CodeChunk*>            mTodo;
+	Channel<CodeChunk*>            mDone;
+	std::atomic<int>               mWorking;
+	std::atomic<bool>              mStop;
+	std::exception_ptr             mReadError;
+	std::exception_ptr             mWorkError;
+	std::mutex                     mErrorLock;
+};
+
+#endif // _PARALLEL_H_
@@ -0,0 +1,65 @@
+
+#include "checksum.h"
+#include "factory.h"
+#include "common/crc32c.h"
+
+CheckSum::CheckSum(int type, int leaf)
+  : mType(type)
+  , mLeaf(leaf)
+  , mPartial(0)
+  , mPartialSize(0)
+{
+	SMART_ASSERT(type >= kSumMD5 && type < kSumMax && leaf > 0)("type", type)("leaf", leaf);
+}
+
+void CheckSum::update(const u_char* data, size_t size)
+{
+	if (mType == kSumMD5)
+	{
+		mMd5.Update(data, size);
+		return;
+	}
+
+	while (size > 0)
+	{
+		const size_t n = std::min(size, integer_cast<size_t>(mLeaf - mPartialSize));
+		mPartial = crc32c::Extend(mPartial, (const char *)data, n);
+		mPartialSize += integer_cast<int>(n);
+		data += n;
+		size -= n;
+
+		if (mPartialSize == mLeaf)
+		{
+			mLeaves.append((const char *)&mPartial, sizeof(mPartial));
+			mPartial = 0;
+			mPartialSize = 0;
+		}
+	}
+}
+
+void CheckSum::append_leaves(const std::string& leaves)
+{
+	SMART_ASSERT(parallel() && mPartialSize == 0);
+	mLeaves.append(leaves);
+}
+
+std::string CheckSum::final()
+{
+	if (mType == kSumMD5)
+	{
+		byte m[16];
+		mMd5.Final(m);
+		return detail::md5_string(m);
+	}
+
+	if (mPartialSize > 0)
+	{
+		mLeaves.append((const char *)&mPartial, sizeof(mPartial));
+		mPartial = 0;
+		mPartialSize = 0;
+	}
+
+	char buf[12];
+	snprintf(buf, sizeof(buf), "%08x", crc32c::Value(mLeaves.data(), mLeaves.size()));
+	return std::string(buf);
+}
@@ -0,0 +1,114 @@
+
+#include "compress.h"
+#include "exception.h"
+#include "common/coding.h"
+#include "common/compression.h"
+#include "common/integer_cast.h"
+#include "common/smart_assert.h"
+
+static bool deflate(int type, const char* data, int size, std::string& packed)
+{
+	switch (type)
+	{
+	case kLZ4:
+		return port::LZ4_Compress(data, integer_cast<size_t>(size), &packed);
+	case kZSTD:
+		return port::ZSTD_Compress(data, integer_cast<size_t>(size), &packed);
+	case kXpress:
+		return port::XPRESS_Compress(data, integer_cast<size_t>(size), &packed);
+	}
+
+	return false;
+}
+
+static bool inflate(int type, const char* data, size_t size, char* output, size_t output_size)
+{
+	switch (type)
+	{
+	case kLZ4:
+		return port::LZ4_Uncompress(data, size, output, output_size);
+	case kZSTD:
+		return port::ZSTD_Uncompress(data, size, output, output_size);
+	case kXpress:
+		return port::XPRESS_Uncompress(data, size, output, output_size);
+	}
+
+	return false;
+}
+
+void compress_frame(int type, const char* data, int size, std::string& dest)
+{
+	SMART_ASSERT(size > 0 && size <= FRAME_SIZE)("size", size);
+
+	std::string packed;
+	PutFixed32(&dest, integer_cast<uint32_t>(size));
+	if (deflate(type, data, size, packed) && packed.size() < integer_cast<size_t>(size))
+	{
+		PutFixed32(&dest, integer_cast<uint32_t>(packed.size()));
+		dest.append(packed);
+	}
+	else
+	{
+		PutFixed32(&dest, 0);
+		dest.append(data, integer_cast<size_t>(size));
+	}
+}
+
+FrameReader::FrameReader(int type)
+  : mType(type)
+  , mPos(0)
+  , mPosition(0)
+  , mTotal(0)
+  , mSkip(0)
+{
+}
+
+void FrameReader::append(const char* data, int size)
+{
+	mStream.erase(0, mPos);
+	mPos = 0;
+	mStream.append(data, integer_cast<size_t>(size));
+}
+
+void FrameReader::skip_to(uint64_t offset)
+{
+	mSkip = offset;
+}
+
+bool FrameReader::next(Slice& plain)
+{
+	while (mStream.size() - mPos >= integer_cast<size_t>(FRAME_HEADER))
+	{
+		const char* header = mStream.data() + mPos;
+		const uint32_t size   = DecodeFixed32(header);
+		const uint32_t packed = DecodeFixed32(header + 4);
+		const uint32_t stored = (packed == 0) ? size : packed;
+		if (size == 0 || size > FRAME_SIZE || stored > size)
+			throw Exception("bad compressed frame");
+
+		if (mStream.size() - mPos - FRAME_HEADER < stored)
+			return false;
+
+		const char* data = header + FRAME_HEADER;
+		mPos += integer_cast<size_t>(FRAME_HEADER + stored);
+		mPosition = mTotal;
+		mTotal += size;
+		if (mTotal <= mSkip)
+			continue;
+
+		if (packed == 0)
+		{
+			plain = make_slice(data, integer_cast<int>(size));
+			return true;
+		}
+
+		mPlain.resize(size);
+		if (!inflate(mType, data, packed, &(mPlain[0]), size))
+			throw Exception("inflate compressed frame failed");
+
+		plain = make_slice(&(mPlain[0]), integer_cast<int>(size));
+		return true;
+	}
+
+	return false;
+}
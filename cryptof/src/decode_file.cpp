@@ -1,12 +1,16 @@
 
 #include "decode_file.h"
 #include "factory.h"
+#include "parallel.h"
 #include "utils.h"
-#include "cryptopp/md5.h"
+#include "checksum.h"
 #include "common/object_pool.h"
+#include "common/crc32c.h"
+#include <limits.h>
 
 DecodeFile::DecodeFile(const Slice& input, const Slice& key)
   : mInput(input)
+  , mThreads(1)
 {
 	SMART_ASSERT(!key.empty());
 	std::string* str = &(mPool.new_object());
@@ -52,6 +56,48 @@ bool DecodeFile::get(const Slice& fsrc, FileMeta& fmeta)
 	}
 }
 
+bool DecodeFile::verify(const Slice& fsrc, const void* data, uint64_t size)
+{
+	try
+	{
+		BOOST_AUTO(iter, mFileList.find(fsrc));
+		if (iter == mFileList.end())
+			return false;
+
+		const FileMeta& fmeta = iter->second;
+		if (size != fmeta.plain_size())
+			return false;
+
+		SMART_ASSERT(fmeta.mMeta.is_vaild() && contains(FileDataCrypto, fmeta.mMeta.mFileDataVersion));
+		CryptoPipeline pipe(FileDataCrypto[fmeta.mMeta.mFileDataVersion], mKey, cached_coder);
+		CheckSum sum(fmeta.mMeta.mSumType, integer_cast<int>(pipe.read_bsize() * CHECK_BLOCKS));
+		sum.update((const u_char *)data, integer_cast<size_t>(size));
+		return match_sum(fmeta, sum);
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << "verify Catch Exception: " << ex.what() << std::endl;
+		return false;
+	}
+}
+
+int DecodeFile::read_range(const Slice& fsrc, uint64_t offset, int length, void* buffer)
+{
+	try
+	{
+		BOOST_AUTO(iter, mFileList.find(fsrc));
+		if (iter == mFileList.end() || length < 0)
+			return -1;
+
+		return read_range_impl(iter->second, offset, length, (char *)buffer);
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << "read_range Catch Exception: " << ex.what() << std::endl;
+		return -1;
+	}
+}
+
 bool DecodeFile::load()
 {
 	try
@@ -76,52 +122,112 @@ bool DecodeFile::pop_impl(const FileMeta& fmeta, const Slice& fdest)
 
 	CryptoMeta& meta  = const_cast<CryptoMeta &>(fmeta.mMeta);
 	uint64_t filesize = fmeta.mFileSize;
+	const uint64_t code_end = fmeta.code_end();
 
-	CryptoPP::Weak::MD5 md5;
+	// the entry is decoded front to back, get its head loading while the pipeline is set up
+	mInput.hint_sequential(fmeta.mOffset, code_end - fmeta.mOffset);
+	mInput.prefetch(fmeta.mOffset, std::min<uint64_t>(code_end - fmeta.mOffset, MAX_BUFSIZE));
 
 	SMART_ASSERT(meta.is_vaild() && contains(FileDataCrypto, meta.mFileDataVersion));
-	CryptoPipeline pipe(FileDataCrypto[meta.mFileDataVersion], mKey, new_coder);
+	CryptoPipeline pipe(FileDataCrypto[meta.mFileDataVersion], mKey, cached_coder);
 
-	if (pipe.write_bsize() != fmeta.mWriteBSize)
+	if (pipe.write_bsize() != fmeta.mWriteBSize || pipe.iv_size() != meta.mIVLength)
 		return false;
 
-	int buffer_size = integer_cast<int32_t>(pipe.write_bsize() * BLOCKS);
-	buffer_size = integer_cast<int32_t>((MAX_BUFSIZE / buffer_size) * buffer_size);
-	std::vector<u_char> store_buffer;
-	store_buffer.resize(buffer_size);
-	u_char* buffer = &(store_buffer[0]);
+	const Slice iv = make_slice(meta.mIV, meta.mIVLength);
+	pipe.set_iv(iv);
+	pipe.set_length(fmeta.mFileSize);
+
+	CheckSum sum(meta.mSumType, integer_cast<int>(pipe.read_bsize() * CHECK_BLOCKS));
 
 	uint64_t offset = fmeta.mOffset;
 	OutputFileStream output(fdest);
-	while (true)
-	{
-		int nread = buffer_size;
-		if (integer_cast<uint64_t>(nread) > meta.mFileEnd - offset)
-			nread = integer_cast<int>(meta.mFileEnd - offset);
-
-		int n = mInput.read(buffer, nread);
-		if (n == 0) break;
-		SMART_ASSERT(n == nread);
-
-		offset += n;
-		Slice result = pipe.decode(buffer, n);
-		SMART_ASSERT(result.size() % integer_cast<int32_t>(pipe.read_bsize()) == 0);
+	output.preallocate(fmeta.plain_size());
 
-		int out = result.size();
-		if (integer_cast<uint64_t>(out) > filesize)
-			out = integer_cast<int>(filesize);
+	// compressed entries are inflated frame by frame on this thread
+	FrameReader frames(pipe.compress());
+	if (mThreads > 1 && pipe.compress() == kNoCompress && parallel_worth(code_end - offset, pipe.write_bsize()))
+	{
+		ParallelCoder coder(FileDataCrypto[meta.mFileDataVersion], mKey, mThreads);
+		coder.set_iv(iv);
+		coder.set_length(fmeta.mFileSize);
+		filesize -= coder.decode(mInput, code_end - offset, output, filesize, sum);
+		offset = integer_cast<uint64_t>(mInput.seekpos());
+	}
+	else
+	{
+		int buffer_size = integer_cast<int32_t>(pipe.write_bsize() * chunk_blocks(pipe.write_bsize()));
+		buffer_size = integer_cast<int32_t>((MAX_BUFSIZE / buffer_size) * buffer_size);
+		std::vector<u_char> store_buffer;
+		if (!mInput.mapped())
+		{
+			store_buffer.resize(buffer_size);
+		}
 
-		filesize -= out;
-		output.write(result.data(), out);
-		md5.Update((const byte *)result.data(), integer_cast<size_t>(out));
+		while (true)
+		{
+			int nread = buffer_size;
+			if (integer_cast<uint64_t>(nread) > code_end - offset)
+				nread = integer_cast<int>(code_end - offset);
+
+			// mapped archives are decoded straight from the page cache
+			const u_char* buffer = nullptr;
+			int n = 0;
+			if (mInput.mapped())
+			{
+				Slice view = mInput.read_view(nread);
+				buffer = (const u_char *)view.data();
+				n = view.size();
+			}
+			else
+			{
+				buffer = &(store_buffer[0]);
+				n = mInput.read(&(store_buffer[0]), nread);
+			}
+
+			if (n == 0) break;
+			SMART_ASSERT(n == nread);
+
+			offset += n;
+			Slice result = pipe.decode(buffer, n);
+			SMART_ASSERT(result.size() % integer_cast<int32_t>(pipe.read_bsize()) == 0);
+
+			int out = result.size();
+			if (integer_cast<uint64_t>(out) > filesize)
+				out = integer_cast<int>(filesize);
+
+			filesize -= out;
+			if (pipe.compress() == kNoCompress)
+			{
+				output.write(result.data(), out);
+				sum.update((const u_char *)result.data(), integer_cast<size_t>(out));
+				continue;
+			}
+
+			Slice plain;
+			frames.append(result.data(), out);
+			while (frames.next(plain))
+			{
+				output.write(plain.data(), plain.size());
+				sum.update((const u_char *)plain.data(), integer_cast<size_t>(plain.size()));
+			}
+		}
 	}
 	output.close();
-	SMART_ASSERT(filesize == 0 && offset == meta.mFileEnd);
+	SMART_ASSERT(filesize == 0 && offset == code_end);
+
+	if (pipe.compress() != kNoCompress && (!frames.done() || frames.total() != meta.mRawSize))
+		return false;
+
+	return match_sum(fmeta, sum);
+}
 
-	byte m[16];
-	md5.Final(m);
-	std::string check_sum = detail::md5_string(m);
-	if (meta.mMd5SumLength == 0)
+// the checksum of the plain data against the one recorded for the entry
+bool DecodeFile::match_sum(const FileMeta& fmeta, CheckSum& sum)
+{
+	CryptoMeta& meta = const_cast<CryptoMeta &>(fmeta.mMeta);
+	std::string check_sum = sum.final();
+	if (meta.mMd5SumLength == 0 && meta.mSumType == kSumMD5)
 	{
 		if (!mInput.name().ends_with(make_slice(check_sum)))
 			return false;
@@ -136,10 +242,291 @@ bool DecodeFile::pop_impl(const FileMeta& fmeta, const Slice& fdest)
 		&& memcmp(meta.mMd5Sum, check_sum.data(), check_sum.size()) == 0;
 }
 
+int DecodeFile::read_range_impl(const FileMeta& fmeta, uint64_t offset, int length, char* buffer)
+{
+	const CryptoMeta& meta = fmeta.mMeta;
+	const uint64_t filesize = fmeta.plain_size();
+	if (offset >= filesize || length == 0)
+		return 0;
+
+	if (integer_cast<uint64_t>(length) > filesize - offset)
+		length = integer_cast<int>(filesize - offset);
+
+	SMART_ASSERT(meta.is_vaild() && contains(FileDataCrypto, meta.mFileDataVersion));
+	CryptoPipeline pipe(FileDataCrypto[meta.mFileDataVersion], mKey, cached_coder);
+	if (pipe.write_bsize() != fmeta.mWriteBSize || pipe.iv_size() != meta.mIVLength)
+		return -1;
+
+	if (pipe.compress() != kNoCompress)
+		return read_frames(fmeta, pipe, offset, length, buffer);
+
+	// every read_bsize() plain bytes are coded into write_bsize() bytes on their own,
+	// decode the covering units only: check chunks when known, single blocks otherwise
+	const bool checked = !fmeta.mChecks.empty();
+	const uint64_t plain_unit  = integer_cast<uint64_t>(pipe.read_bsize())  * (checked ? CHECK_BLOCKS : 1);
+	const uint64_t code_unit   = integer_cast<uint64_t>(pipe.write_bsize()) * (checked ? CHECK_BLOCKS : 1);
+	const uint64_t first = offset / plain_unit;
+	const uint64_t last  = (offset + length - 1) / plain_unit;
+
+	if (checked && (last + 1) * sizeof(uint32_t) > integer_cast<uint64_t>(fmeta.mChecks.size()))
+		return -1;
+
+	const uint64_t code_begin = fmeta.mOffset + first * code_unit;
+	const uint64_t code_end   = std::min(fmeta.mOffset + (last + 1) * code_unit, fmeta.code_end());
+	if (code_begin >= code_end)
+		return -1;
+
+	const int nread = integer_cast<int>(code_end - code_begin);
+	std::vector<u_char> store_buffer;
+	Slice code;
+	mInput.prefetch(code_begin, code_end - code_begin);
+	mInput.clear();
+	mInput.seekg(integer_cast<std::streamoff>(code_begin), mInput.beg());
+	if (mInput.mapped())
+	{
+		code = mInput.read_view(nread);
+	}
+	else
+	{
+		store_buffer.resize(nread);
+		code = make_slice(&(store_buffer[0]), mInput.read(&(store_buffer[0]), nread));
+	}
+
+	if (code.size() != nread)
+		return -1;
+
+	if (checked)
+	{
+		std::string checks;
+		append_checks(checks, (const u_char *)code.data(), code.size(), integer_cast<int>(code_unit));
+		if (memcmp(checks.data(), fmeta.mChecks.data() + first * sizeof(uint32_t), checks.size()) != 0)
+			return -1;
+	}
+
+	pipe.set_iv(make_slice(meta.mIV, meta.mIVLength));
+	pipe.set_length(fmeta.mFileSize);
+	pipe.seek(first * (checked ? CHECK_BLOCKS : 1));
+	Slice plain = pipe.decode((const u_char *)code.data(), code.size());
+	const uint64_t skip = offset - first * plain_unit;
+	if (integer_cast<uint64_t>(plain.size()) < skip + length)
+		return -1;
+
+	memcpy(buffer, plain.data() + skip, length);
+	return length;
+}
+
+// frames have no fixed place in the coded data, decode the stream from the start
+// of the entry and inflate the frames overlapping the range only
+int DecodeFile::read_frames(const FileMeta& fmeta, CryptoPipeline& pipe, uint64_t offset, int length, char* buffer)
+{
+	const CryptoMeta& meta = fmeta.mMeta;
+	const bool checked = !fmeta.mChecks.empty();
+	const int code_unit = integer_cast<int>(pipe.write_bsize() * CHECK_BLOCKS);
+	const int buffer_size = integer_cast<int>(pipe.write_bsize() * chunk_blocks(pipe.write_bsize()));
+
+	pipe.set_iv(make_slice(meta.mIV, meta.mIVLength));
+	pipe.set_length(fmeta.mFileSize);
+	FrameReader frames(pipe.compress());
+	frames.skip_to(offset);
+
+	std::vector<u_char> store_buffer;
+	if (!mInput.mapped())
+	{
+		store_buffer.resize(buffer_size);
+	}
+
+	const uint64_t code_end = fmeta.code_end();
+	mInput.prefetch(fmeta.mOffset, std::min<uint64_t>(code_end - fmeta.mOffset, MAX_BUFSIZE));
+	mInput.clear();
+	mInput.seekg(integer_cast<std::streamoff>(fmeta.mOffset), mInput.beg());
+	uint64_t code_offset = fmeta.mOffset;
+	uint64_t stream = fmeta.mFileSize;
+	size_t check_offset = 0;
+	int copied = 0;
+	while (copied < length && code_offset < code_end)
+	{
+		int nread = buffer_size;
+		if (integer_cast<uint64_t>(nread) > code_end - code_offset)
+			nread = integer_cast<int>(code_end - code_offset);
+
+		Slice code;
+		if (mInput.mapped())
+		{
+			code = mInput.read_view(nread);
+		}
+		else
+		{
+			code = make_slice(&(store_buffer[0]), mInput.read(&(store_buffer[0]), nread));
+		}
+
+		if (code.size() != nread)
+			return -1;
+
+		code_offset += nread;
+		if (checked)
+		{
+			std::string checks;
+			append_checks(checks, (const u_char *)code.data(), code.size(), code_unit);
+			if (check_offset + checks.size() > integer_cast<size_t>(fmeta.mChecks.size())
+				|| memcmp(checks.data(), fmeta.mChecks.data() + check_offset, checks.size()) != 0)
+				return -1;
+
+			check_offset += checks.size();
+		}
+
+		Slice result = pipe.decode((const u_char *)code.data(), code.size());
+		int out = result.size();
+		if (integer_cast<uint64_t>(out) > stream)
+			out = integer_cast<int>(stream);
+
+		stream -= out;
+		frames.append(result.data(), out);
+
+		Slice plain;
+		while (copied < length && frames.next(plain))
+		{
+			const uint64_t skip = offset + copied - frames.position();
+			const int n = std::min(integer_cast<int>(plain.size() - skip), length - copied);
+			memcpy(buffer + copied, plain.data() + skip, n);
+			copied += n;
+		}
+	}
+
+	return (copied == length) ? length : -1;
+}
+
 bool DecodeFile::load_impl()
+{
+	if (load_index())
+		return true;
+
+	// no (valid) directory: legacy archive, walk the entry headers
+	mFileList.clear();
+	mInput.clear();
+	return load_scan();
+}
+
+Slice DecodeFile::decode_name(const Slice& name, const CryptoMeta& meta)
+{
+	std::string& filename = mPool.new_object();
+	decode_filename(filename, name, mKey, meta.mFileNameVersion);
+	Slice result = make_slice(filename);
+	if (meta.mFileNameLength != 0)
+	{
+		result = result.substr(0, meta.mFileNameLength);
+	}
+
+	if (!IsUTF8(result))
+	{
+		result = DecodeFileName(result, mBuffPool.new_object());
+	}
+
+	return result;
+}
+
+// bytes [offset, offset + size) of the input, viewed in the mapping or read into store
+static Slice read_block(InputFileStream& input, uint64_t offset, int size, std::vector<char>& store)
+{
+	input.clear();
+	input.seekg(integer_cast<std::streamoff>(offset), input.beg());
+	if (input.mapped())
+		return input.read_view(size);
+
+	store.resize(size);
+	return make_slice(&(store[0]), input.read(&(store[0]), size));
+}
+
+bool DecodeFile::load_index()
+{
+	mInput.clear();
+	mInput.seekg(0, mInput.end());
+	const uint64_t total = integer_cast<uint64_t>(mInput.seekpos());
+	if (total < sizeof(IndexFooter) + INDEX_STOP_SIZE)
+		return false;
+
+	// one read of the archive tail gets the footer and, unless it is larger, the directory
+	const uint64_t tail_offset = total - std::min<uint64_t>(total, INDEX_TAIL_SIZE);
+	std::vector<char> tail_buffer;
+	const Slice tail = read_block(mInput, tail_offset, integer_cast<int>(total - tail_offset), tail_buffer);
+	if (tail.size() != integer_cast<int>(total - tail_offset))
+		return false;
+
+	IndexFooter footer;
+	memcpy(&footer, tail.data() + tail.size() - sizeof(footer), sizeof(footer));
+	if (memcmp(footer.mMagic, INDEX_MAGIC, sizeof(footer.mMagic)) != 0
+		|| footer.mIndexSize < INDEX_STOP_SIZE
+		|| footer.mIndexOffset + footer.mIndexSize + sizeof(IndexFooter) != total
+		|| footer.mIndexSize > static_cast<uint64_t>(INT_MAX))
+		return false;
+
+	const int index_size = integer_cast<int>(footer.mIndexSize);
+	std::vector<char> index_buffer;
+	Slice index;
+	if (footer.mIndexOffset >= tail_offset)
+	{
+		index = tail.substr(integer_cast<size_t>(footer.mIndexOffset - tail_offset), index_size);
+	}
+	else
+	{
+		index = read_block(mInput, footer.mIndexOffset, index_size, index_buffer);
+	}
+
+	if (index.size() != index_size
+		|| crc32c::Value(index.data(), index.size()) != footer.mIndexCrc)
+		return false;
+
+	index.remove_prefix(integer_cast<int>(INDEX_STOP_SIZE));
+	for (uint32_t i = 0; i < footer.mCount; ++i)
+	{
+		if (index.size() < integer_cast<int>(sizeof(IndexEntry)))
+			return false;
+
+		IndexEntry entry;
+		memcpy(&entry, index.data(), sizeof(entry));
+		index.remove_prefix(sizeof(entry));
+		if (entry.mNameLength <= 0 || entry.mNameLength > index.size())
+			return false;
+
+		const CryptoMeta& meta = entry.mMeta;
+		if (!meta.is_vaild()
+			|| entry.mOffset > meta.mFileEnd
+			|| meta.mFileEnd > footer.mIndexOffset
+			|| (meta.mCheckOffset > 0 && (meta.mCheckOffset < entry.mOffset || meta.mCheckOffset > meta.mFileEnd)))
+			return false;
+
+		FileMeta fmeta;
+		fmeta.mOffset     = entry.mOffset;
+		fmeta.mFileSize   = entry.mFileSize;
+		fmeta.mWriteBSize = entry.mWriteBSize;
+		fmeta.mMeta       = meta;
+		fmeta.mName       = decode_name(index.substr(0, entry.mNameLength), meta);
+		index.remove_prefix(entry.mNameLength);
+
+		// checks are only usable with the block grouping of this build
+		const int check_size = integer_cast<int>(entry.mCheckCount * sizeof(uint32_t));
+		if (check_size > index.size())
+			return false;
+
+		if (entry.mCheckBlocks == CHECK_BLOCKS && check_size > 0)
+		{
+			std::string& checks = mPool.new_object();
+			index.substr(0, check_size).copy_to(&checks);
+			fmeta.mChecks = make_slice(checks);
+		}
+		index.remove_prefix(check_size);
+
+		BOOST_AUTO(result, mFileList.insert(std::make_pair(fmeta.mName, fmeta)));
+		if (!result.second) return false;
+	}
+
+	return index.empty();
+}
+
+bool DecodeFile::load_scan()
 {
 	mInput.seekg(0, mInput.beg());
 
+	const std::string stop(integer_cast<size_t>(INDEX_STOP_SIZE), '0');
 	char size_buf[UNUSED_SIZE];
 	while (true)
 	{
@@ -149,6 +536,9 @@ bool DecodeFile::load_impl()
 
 		// header:
 		Slice header = make_slice(size_buf, 32);
+		if (header == make_slice(stop))
+			break; // directory trailer
+
 		FileMeta fmeta;
 		const uint32_t namelen = integer_cast<uint32_t>(atoi(header.substr(0, 6)));
 		fmeta.mFileSize   = atoi(header.substr(6, 20));
@@ -171,18 +561,24 @@ bool DecodeFile::load_impl()
 		if (!meta.is_vaild()) return false;
 
 		fmeta.mOffset = mInput.seekpos();
+		fmeta.mName   = decode_name(make_slice(namebuf), meta);
 
-		std::string& filename = mPool.new_object();
-		decode_filename(filename, make_slice(namebuf), mKey, meta.mFileNameVersion);
-		fmeta.mName = make_slice(filename);
-		if (meta.mFileNameLength != 0)
-		{
-			fmeta.mName = fmeta.mName.substr(0, meta.mFileNameLength);
-		}
-
-		if (!IsUTF8(fmeta.mName))
+		// checks: between the coded data and the end of the entry
+		if (meta.mCheckOffset > 0)
 		{
-			fmeta.mName = DecodeFileName(fmeta.mName, mBuffPool.new_object());
+			const uint64_t check_size = meta.mCheckCount * sizeof(uint32_t);
+			if (meta.mCheckOffset < fmeta.mOffset || meta.mCheckOffset + check_size > meta.mFileEnd)
+				return false;
+
+			if (meta.mCheckBlocks == CHECK_BLOCKS && check_size > 0)
+			{
+				std::string& checks = mPool.new_object();
+				checks.resize(integer_cast<size_t>(check_size));
+				mInput.seekg(integer_cast<std::streamoff>(meta.mCheckOffset), mInput.beg());
+				n = mInput.read((char *)checks.data(), integer_cast<int>(check_size));
+				if (n != integer_cast<int>(check_size)) return false;
+				fmeta.mChecks = make_slice(checks);
+			}
 		}
 
 		// skip data:
@@ -1,11 +1,50 @@
 
 #include "encode_file.h"
+#include "parallel.h"
 #include "utils.h"
-#include "cryptopp/md5.h"
+#include "checksum.h"
+#include "cryptopp/osrng.h"
+#include "common/crc32c.h"
+#include "common/channel.h"
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <thread>
+
+// push_many() codes files up to this size in memory, larger ones are streamed
+static const int64_t kPackSize = 4 * 1024 * 1024;
+
+struct PackedEntry
+{
+	std::string        mData;   // header up to the end of the coded data
+	std::string        mName;   // encoded file name
+	std::string        mChecks;
+	FileMeta           mMeta;   // mOffset and mFileEnd relative to mData
+	std::exception_ptr mError;
+	size_t             mIndex;
+	bool               mStream; // too large, pushed by the writer
+};
+
+// every worker takes a free slot, then the next file; the writer appends
+// the entries in list order and hands the slots back
+struct PackBatch
+{
+	const std::vector<Slice>* mFiles;
+	CryptoVersion             mVersion;
+	std::vector<PackedEntry>  mSlots;
+	Channel<PackedEntry*>     mFree;
+	Channel<PackedEntry*>     mDone;
+	std::atomic<size_t>       mNext;
+	std::atomic<bool>         mStop;
+};
 
 EncodeFile::EncodeFile(const Slice& output, const Slice& key)
   : mOutput(output)
   , mDefault(v0)
+  , mThreads(1)
+  , mCheckSum(kSumMD5)
+  , mIndex(false)
+  , mClosed(false)
 {
 	SMART_ASSERT(!output.empty() && !key.empty());
 	std::string* str = &(mPool.new_object());
@@ -13,10 +52,20 @@ EncodeFile::EncodeFile(const Slice& output, const Slice& key)
 	mKey = make_slice(*str);
 }
 
+EncodeFile::~EncodeFile()
+{
+	close();
+}
+
 bool EncodeFile::push(const Slice& fsrc, const CryptoVersion* version)
 {
 	try
 	{
+		if (mClosed)
+		{
+			return false;
+		}
+
 		if (version == nullptr)
 		{
 			version = &mDefault;
@@ -31,6 +80,35 @@ bool EncodeFile::push(const Slice& fsrc, const CryptoVersion* version)
 	}
 }
 
+bool EncodeFile::push_many(const std::vector<Slice>& fsrcs, int threads, const CryptoVersion* version)
+{
+	try
+	{
+		if (mClosed)
+		{
+			return false;
+		}
+
+		if (version == nullptr)
+		{
+			version = &mDefault;
+		}
+
+		// the coder threads only read the version maps
+		if (!contains(FileNameCrypto, version->first) || !contains(FileDataCrypto, version->second))
+		{
+			return false;
+		}
+
+		return push_many_impl(fsrcs, (threads > 0) ? threads : 1, *version);
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << "push_many Catch Exception: " << ex.what() << std::endl;
+		return false;
+	}
+}
+
 bool EncodeFile::get(const Slice& fsrc, FileMeta& fmeta)
 {
 	try
@@ -51,9 +129,134 @@ bool EncodeFile::get(const Slice& fsrc, FileMeta& fmeta)
 	}
 }
 
+bool EncodeFile::close()
+{
+	try
+	{
+		if (mClosed)
+			return true;
+
+		mClosed = true;
+		if (mIndex)
+		{
+			write_index();
+		}
+
+		mOutput.flush();
+		mOutput.close();
+		return true;
+	}
+	catch (std::exception& ex)
+	{
+		std::cerr << "close Catch Exception: " << ex.what() << std::endl;
+		return false;
+	}
+}
+
+static bool offset_less(const FileMeta* a, const FileMeta* b)
+{
+	return a->mOffset < b->mOffset;
+}
+
+void EncodeFile::write_index()
+{
+	std::vector<const FileMeta*> entries;
+	entries.reserve(mFileList.size());
+	for (BOOST_AUTO(iter, mFileList.begin()); iter != mFileList.end(); ++iter)
+	{
+		entries.push_back(&(iter->second));
+	}
+	std::sort(entries.begin(), entries.end(), offset_less);
+
+	std::string index(integer_cast<size_t>(INDEX_STOP_SIZE), '0');
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		const FileMeta& fmeta = *(entries[i]);
+
+		IndexEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.mOffset      = fmeta.mOffset + 32 + integer_cast<uint64_t>(fmeta.mName.size()) + UNUSED_SIZE;
+		entry.mFileSize    = fmeta.mFileSize;
+		entry.mWriteBSize  = fmeta.mWriteBSize;
+		entry.mNameLength  = fmeta.mName.size();
+		entry.mCheckBlocks = integer_cast<uint32_t>(CHECK_BLOCKS);
+		entry.mCheckCount  = integer_cast<uint32_t>(fmeta.mChecks.size() / sizeof(uint32_t));
+		entry.mMeta        = fmeta.mMeta;
+
+		index.append((const char *)&entry, sizeof(entry));
+		index.append(fmeta.mName.data(), fmeta.mName.size());
+		index.append(fmeta.mChecks.data(), fmeta.mChecks.size());
+	}
+
+	IndexFooter footer;
+	memset(&footer, 0, sizeof(footer));
+	memcpy(footer.mMagic, INDEX_MAGIC, sizeof(footer.mMagic));
+	footer.mIndexOffset = integer_cast<uint64_t>(mOutput.seekpos());
+	footer.mIndexSize   = integer_cast<uint64_t>(index.size());
+	footer.mIndexCrc    = crc32c::Value(index.data(), index.size());
+	footer.mCount       = integer_cast<uint32_t>(entries.size());
+
+	mOutput.write(index.data(), integer_cast<int>(index.size()));
+	mOutput.write(&footer, sizeof(footer));
+}
+
+// 32 bytes: name length, file size, write block size
+static std::string entry_header(size_t namelen, uint64_t filesize, int write_bsize)
+{
+	SMART_ASSERT(namelen < 999999);
+	char header[64];
+	const int count = snprintf(header, sizeof(header), "%06d%020lld%06d",
+		integer_cast<uint32_t>(namelen), filesize, write_bsize);
+	SMART_ASSERT(count == 32)("count", count);
+	return std::string(header, count);
+}
+
+// AEAD coders get a fresh nonce per entry, the key is shared by the archive
+static void entry_iv(CryptoPipeline& pipe, CryptoMeta& meta)
+{
+	meta.mIVLength = pipe.iv_size();
+	SMART_ASSERT(meta.mIVLength <= integer_cast<int>(sizeof(meta.mIV)));
+	if (meta.mIVLength > 0)
+	{
+		CryptoPP::AutoSeededRandomPool rng;
+		rng.GenerateBlock(meta.mIV, integer_cast<size_t>(meta.mIVLength));
+		pipe.set_iv(make_slice(meta.mIV, meta.mIVLength));
+	}
+}
+
+static void entry_meta(CryptoMeta& meta, const CryptoVersion& version, const Slice& fsrc, CheckSum& sum, uint64_t end_offset)
+{
+	std::string check_sum = sum.final();
+	SMART_ASSERT(check_sum.size() < sizeof(meta.mMd5Sum));
+	meta.mFileNameVersion = version.first;
+	meta.mFileDataVersion = version.second;
+	meta.mFileNameLength  = fsrc.size();
+	meta.mMd5SumLength    = integer_cast<int>(check_sum.size());
+	meta.mSumType         = sum.type();
+	meta.mFileEnd         = end_offset;
+	memcpy(meta.mMd5Sum, check_sum.data(), check_sum.size());
+}
+
+// the checks of the coded data follow it, so that read_range can verify what it
+// decodes without the directory; block coders older decoders know get them zero
+// padded to whole write blocks, those decoders decode the pad past the file size
+static void entry_checks(std::string& dest, CryptoMeta& meta, const CryptoPipeline& pipe, const std::string& checks, uint64_t check_offset)
+{
+	meta.mCheckOffset = check_offset;
+	meta.mCheckBlocks = integer_cast<uint32_t>(CHECK_BLOCKS);
+	meta.mCheckCount  = integer_cast<uint32_t>(checks.size() / sizeof(uint32_t));
+
+	dest.append(checks);
+	if (pipe.iv_size() == 0 && pipe.compress() == kNoCompress)
+	{
+		const size_t bsize = integer_cast<size_t>(pipe.write_bsize());
+		dest.append((bsize - checks.size() % bsize) % bsize, '\0');
+	}
+}
+
 bool EncodeFile::push_impl(const Slice& fsrc, const CryptoVersion& version)
 {
-	CryptoPipeline  pipe(FileDataCrypto[version.second], mKey, new_coder);
+	CryptoPipeline  pipe(FileDataCrypto[version.second], mKey, cached_coder);
 	InputFileStream input(fsrc);
 
 	FileMeta fmeta;
@@ -64,72 +267,378 @@ bool EncodeFile::push_impl(const Slice& fsrc, const CryptoVersion& version)
 	fmeta.mFileSize = integer_cast<uint64_t>(input.seekpos());
 	input.seekg(0, input.beg());
 
-	char size_fmt[UNUSED_SIZE];
-
-	// filename.1:
+	// header + filename:
 	std::string& filename = mPool.new_object();
 	encode_filename(filename, fsrc, mKey, version.first);
 	fmeta.mName = make_slice(filename);
-	SMART_ASSERT(fmeta.mName.size() < 999999);
-	int count = snprintf(size_fmt, 12, "%06d", integer_cast<uint32_t>(fmeta.mName.size()));
-	mOutput.write(size_fmt, count);
-
-	// filesize:
-	count = snprintf(size_fmt, 21, "%020lld", fmeta.mFileSize);
-	mOutput.write(size_fmt, count);
-
-	// write blocksize:
 	fmeta.mWriteBSize = pipe.write_bsize();
-	count = snprintf(size_fmt, 12, "%06d", fmeta.mWriteBSize);
-	mOutput.write(size_fmt, count);
-
-    // filename.2:
+	std::string header = entry_header(filename.size(), fmeta.mFileSize, fmeta.mWriteBSize);
+	if (pipe.compress() == kNoCompress)
+	{
+		// the coded size is known up front: one extra block for the padding,
+		// then the check list padded to a write block
+		const uint64_t coded  = (fmeta.mFileSize / pipe.read_bsize() + 1) * pipe.write_bsize();
+		const uint64_t checks = (coded / (pipe.write_bsize() * CHECK_BLOCKS) + 1) * sizeof(uint32_t) + pipe.write_bsize();
+		mOutput.preallocate(fmeta.mOffset + header.size() + filename.size() + UNUSED_SIZE + coded + checks);
+	}
+	mOutput.write(header.data(), header.size());
 	mOutput.write(fmeta.mName.data(), fmeta.mName.size());
 
 	// unused: <- meta
 	SMART_ASSERT(sizeof(CryptoMeta) <= UNUSED_SIZE);
-	const std::streampos meta_offset = mOutput.tellp();
-	memset(size_fmt, 0, UNUSED_SIZE);
-	mOutput.write(size_fmt, UNUSED_SIZE);
+	const uint64_t meta_offset = integer_cast<uint64_t>(mOutput.seekpos());
+	char unused[UNUSED_SIZE];
+	memset(unused, 0, UNUSED_SIZE);
+	mOutput.write(unused, UNUSED_SIZE);
+
+	CryptoMeta& meta = fmeta.mMeta;
+	entry_iv(pipe, meta);
+
+	CheckSum sum(mCheckSum, integer_cast<int>(pipe.read_bsize() * CHECK_BLOCKS));
+	std::string& checks = mPool.new_object();
+	const int check_size = integer_cast<int>(pipe.write_bsize() * CHECK_BLOCKS);
+	meta.mRawSize = fmeta.mFileSize;
+	if (pipe.compress() != kNoCompress)
+	{
+		fmeta.mFileSize = push_frames(input, pipe, sum, checks);
+	}
+	else if (mThreads > 1 && parallel_worth(fmeta.mFileSize, pipe.read_bsize()))
+	{
+		ParallelCoder coder(FileDataCrypto[version.second], mKey, mThreads);
+		coder.set_iv(make_slice(meta.mIV, meta.mIVLength));
+		coder.set_length(fmeta.mFileSize);
+		coder.encode(input, fmeta.mFileSize, mOutput, sum, checks);
+	}
+	else
+	{
+		pipe.set_length(fmeta.mFileSize);
+		int buffer_size = integer_cast<int32_t>(pipe.read_bsize() * chunk_blocks(pipe.read_bsize()));
+		buffer_size = integer_cast<int32_t>((MAX_BUFSIZE / buffer_size) * buffer_size);
+		const int out = integer_cast<int32_t>(pipe.write_bsize() * (buffer_size / pipe.read_bsize()));
+		std::vector<u_char> store_buffer;
+		if (!input.mapped())
+		{
+			store_buffer.resize(buffer_size);
+		}
+
+		while (true)
+		{
+			const u_char* buffer = nullptr;
+			int n = 0;
+			if (input.mapped())
+			{
+				Slice view = input.read_view(buffer_size);
+				buffer = (const u_char *)view.data();
+				n = view.size();
+			}
+			else
+			{
+				buffer = &(store_buffer[0]);
+				n = input.read(&(store_buffer[0]), buffer_size);
+			}
+
+			if (n == 0) break;
+			sum.update(buffer, integer_cast<size_t>(n));
 
-	int buffer_size = integer_cast<int32_t>(pipe.read_bsize() * BLOCKS);
-	buffer_size = integer_cast<int32_t>((MAX_BUFSIZE / buffer_size) * buffer_size);
-	const int out = integer_cast<int32_t>(pipe.write_bsize() * (buffer_size / pipe.read_bsize()));
+			Slice result = pipe.encode(buffer, n);
+			SMART_ASSERT(n < buffer_size || result.size() == out);
+			mOutput.write(result.data(), result.size());
+			append_checks(checks, (const u_char *)result.data(), result.size(), check_size);
+		}
+	}
+	input.close();
+	fmeta.mChecks = make_slice(checks);
+
+	std::string check_block;
+	entry_checks(check_block, meta, pipe, checks, integer_cast<uint64_t>(mOutput.seekpos()));
+	mOutput.write(check_block.data(), integer_cast<int>(check_block.size()));
+
+	const uint64_t end_offset = integer_cast<uint64_t>(mOutput.seekpos());
+	entry_meta(meta, version, fsrc, sum, end_offset);
+	std::cout << end_offset << ", checksum: " << make_slice(meta.mMd5Sum, meta.mMd5SumLength) << std::endl;
+
+	// compressed: the header holds the size of the frame stream
+	if (pipe.compress() != kNoCompress)
+	{
+		header = entry_header(filename.size(), fmeta.mFileSize, fmeta.mWriteBSize);
+		mOutput.pwrite(header.data(), integer_cast<int>(header.size()), fmeta.mOffset);
+	}
+
+	mOutput.pwrite(&meta, sizeof(meta), meta_offset);
+	mOutput.flush();
+
+	BOOST_AUTO(result, mFileList.insert(std::make_pair(fmeta.mName, fmeta)));
+	return result.second;
+}
+
+// the frames of the plain data, coded in whole check chunks,
+// returns the size of the frame stream
+uint64_t EncodeFile::push_frames(InputFileStream& input, CryptoPipeline& pipe, CheckSum& sum, std::string& checks)
+{
+	const int unit = integer_cast<int>(pipe.read_bsize() * CHECK_BLOCKS);
+	const int check_size = integer_cast<int>(pipe.write_bsize() * CHECK_BLOCKS);
+	const int frame_size = integer_cast<int>(FRAME_SIZE);
+	std::vector<u_char> store_buffer;
+	if (!input.mapped())
+	{
+		store_buffer.resize(frame_size);
+	}
+
+	std::string stream;
+	uint64_t total = 0;
+	while (true)
+	{
+		const u_char* buffer = nullptr;
+		int n = 0;
+		if (input.mapped())
+		{
+			Slice view = input.read_view(frame_size);
+			buffer = (const u_char *)view.data();
+			n = view.size();
+		}
+		else
+		{
+			buffer = &(store_buffer[0]);
+			n = input.read(&(store_buffer[0]), frame_size);
+		}
+
+		if (n > 0)
+		{
+			sum.update(buffer, integer_cast<size_t>(n));
+			compress_frame(pipe.compress(), (const char *)buffer, n, stream);
+		}
+
+		// only the last piece may end inside a check chunk; it is held back until the
+		// input ends, AEAD coders seal it with the length of the stream
+		size_t ready = (stream.size() > integer_cast<size_t>(unit)) ? (stream.size() - 1) / unit * unit : 0;
+		if (n == 0)
+		{
+			ready = stream.size();
+			pipe.set_length(total + ready);
+		}
+
+		if (ready > 0)
+		{
+			Slice result = pipe.encode((const u_char *)stream.data(), integer_cast<int>(ready));
+			mOutput.write(result.data(), result.size());
+			append_checks(checks, (const u_char *)result.data(), result.size(), check_size);
+			stream.erase(0, ready);
+			total += ready;
+		}
+
+		if (n == 0) break;
+	}
+
+	return total;
+}
+
+void EncodeFile::pack_impl(const Slice& fsrc, const CryptoVersion& version, PackedEntry& entry) const
+{
+	InputFileStream input(fsrc);
+	input.seekg(0, input.end());
+	const uint64_t filesize = integer_cast<uint64_t>(input.seekpos());
+	input.seekg(0, input.beg());
+
+	entry.mStream = (filesize > integer_cast<uint64_t>(kPackSize));
+	if (entry.mStream)
+		return;
+
+	CryptoPipeline pipe(FileDataCrypto.find(version.second)->second, mKey, cached_coder);
+
+	FileMeta& fmeta = entry.mMeta;
+	fmeta = FileMeta();
+	fmeta.mFileSize   = filesize;
+	fmeta.mWriteBSize = pipe.write_bsize();
+
+	CryptoMeta& meta = fmeta.mMeta;
+	meta.mRawSize = filesize;
+	entry_iv(pipe, meta);
+
+	// the whole file in one go
+	int size = integer_cast<int>(filesize);
 	std::vector<u_char> store_buffer;
-	store_buffer.resize(buffer_size);
-	u_char* buffer = &(store_buffer[0]);
+	const u_char* buffer = nullptr;
+	if (input.mapped())
+	{
+		buffer = (const u_char *)input.read_view(size).data();
+	}
+	else if (size > 0)
+	{
+		store_buffer.resize(size);
+		buffer = &(store_buffer[0]);
+		if (input.read(&(store_buffer[0]), size) != size)
+			throw Exception("read data from file failed");
+	}
 
-	int n = 0;
-	CryptoPP::Weak::MD5 md5;
-	while ((n = input.read((char *)buffer, buffer_size)) != 0)
+	CheckSum sum(mCheckSum, integer_cast<int>(pipe.read_bsize() * CHECK_BLOCKS));
+	if (size > 0)
 	{
-		md5.Update(buffer, integer_cast<size_t>(n));
+		sum.update(buffer, integer_cast<size_t>(size));
+	}
+
+	std::string frames;
+	if (pipe.compress() != kNoCompress)
+	{
+		for (int pos = 0; pos < size; pos += integer_cast<int>(FRAME_SIZE))
+		{
+			const int n = std::min(integer_cast<int>(FRAME_SIZE), size - pos);
+			compress_frame(pipe.compress(), (const char *)buffer + pos, n, frames);
+		}
 
-		Slice result = pipe.encode(buffer, n);
-		SMART_ASSERT(n < buffer_size || result.size() == out);
-		mOutput.write(result.data(), result.size());
+		buffer = (const u_char *)frames.data();
+		size = integer_cast<int>(frames.size());
+		fmeta.mFileSize = frames.size();
+	}
+
+	entry.mName.clear();
+	encode_filename(entry.mName, fsrc, mKey, version.first);
+
+	entry.mData = entry_header(entry.mName.size(), fmeta.mFileSize, fmeta.mWriteBSize);
+	entry.mData.append(entry.mName);
+	entry.mData.append(integer_cast<size_t>(UNUSED_SIZE), '\0'); // meta, patched by the writer
+
+	entry.mChecks.clear();
+	if (size > 0)
+	{
+		pipe.set_length(integer_cast<uint64_t>(size));
+		Slice result = pipe.encode(buffer, size);
+		entry.mData.append(result.data(), result.size());
+		append_checks(entry.mChecks, (const u_char *)result.data(), result.size(),
+			integer_cast<int>(pipe.write_bsize() * CHECK_BLOCKS));
 	}
 	input.close();
 
-	const std::streampos end_offset = mOutput.tellp();
+	entry_checks(entry.mData, meta, pipe, entry.mChecks, integer_cast<uint64_t>(entry.mData.size()));
+	entry_meta(meta, version, fsrc, sum, integer_cast<uint64_t>(entry.mData.size()));
+}
+
+bool EncodeFile::push_many_impl(const std::vector<Slice>& fsrcs, int threads, const CryptoVersion& version)
+{
+	PackBatch batch;
+	batch.mFiles   = &fsrcs;
+	batch.mVersion = version;
+	batch.mNext    = 0;
+	batch.mStop    = false;
+	batch.mSlots.resize(integer_cast<size_t>(threads * 2 + 2));
+	for (size_t i = 0; i < batch.mSlots.size(); ++i)
+	{
+		PackedEntry* slot = &(batch.mSlots[i]);
+		batch.mFree.Write(std::move(slot));
+	}
+
+	std::vector<std::thread> workers;
+	for (int i = 0; i < threads; ++i)
+	{
+		workers.push_back(std::thread(&EncodeFile::pack_loop, this, &batch));
+	}
+
+	bool success = true;
+	std::exception_ptr write_error;
+	std::map<size_t, PackedEntry*> pending;
+	size_t written = 0;
+	PackedEntry* slot = nullptr;
+	while (written < fsrcs.size() && batch.mDone.Read(slot))
+	{
+		pending.insert(std::make_pair(slot->mIndex, slot));
+		while (!pending.empty() && pending.begin()->first == written)
+		{
+			PackedEntry* entry = pending.begin()->second;
+			pending.erase(pending.begin());
+			++written;
+
+			try
+			{
+				if (batch.mStop)
+				{
+					success = false;
+				}
+				else if (entry->mError)
+				{
+					std::rethrow_exception(entry->mError);
+				}
+				else if (entry->mStream)
+				{
+					success = push_impl(fsrcs[entry->mIndex], version) && success;
+				}
+				else
+				{
+					success = push_packed(*entry) && success;
+				}
+			}
+			catch (std::exception& ex)
+			{
+				// a bad input file skips that entry, a failed write stops the batch
+				std::cerr << "push_many Catch Exception: " << ex.what() << std::endl;
+				success = false;
+				if (!entry->mError)
+				{
+					write_error = std::current_exception();
+					batch.mStop = true;
+				}
+			}
+
+			batch.mFree.Write(std::move(entry));
+		}
+	}
+
+	batch.mFree.SendEof();
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		workers[i].join();
+	}
+
+	if (write_error)
+		std::rethrow_exception(write_error);
+
+	return success;
+}
+
+void EncodeFile::pack_loop(PackBatch* batch)
+{
+	PackedEntry* slot = nullptr;
+	while (batch->mFree.Read(slot))
+	{
+		const size_t index = batch->mNext++;
+		if (index >= batch->mFiles->size())
+			break;
+
+		slot->mIndex  = index;
+		slot->mError  = std::exception_ptr();
+		slot->mStream = false;
+		if (!batch->mStop)
+		{
+			try
+			{
+				pack_impl((*batch->mFiles)[index], batch->mVersion, *slot);
+			}
+			catch (...)
+			{
+				slot->mError = std::current_exception();
+			}
+		}
+		batch->mDone.Write(std::move(slot));
+	}
+}
 
-	byte m[16];
-	md5.Final(m);
-	std::string check_sum = detail::md5_string(m);
-	std::cout << end_offset << ", md5: " << check_sum << std::endl;
+bool EncodeFile::push_packed(PackedEntry& entry)
+{
+	FileMeta fmeta = entry.mMeta;
+	fmeta.mOffset = integer_cast<uint64_t>(mOutput.seekpos());
 
 	CryptoMeta& meta = fmeta.mMeta;
-	SMART_ASSERT(check_sum.size() < sizeof(meta.mMd5Sum));
-	meta.mFileNameVersion = version.first;
-	meta.mFileDataVersion = version.second;
-	meta.mFileNameLength  = fsrc.size();
-	meta.mMd5SumLength    = integer_cast<int>(check_sum.size());
-	meta.mFileEnd         = integer_cast<uint64_t>(static_cast<std::streamoff>(end_offset));
-	memcpy(meta.mMd5Sum, check_sum.data(), check_sum.size());
+	meta.mFileEnd     += fmeta.mOffset;
+	meta.mCheckOffset += fmeta.mOffset;
+	memcpy(&(entry.mData[32 + entry.mName.size()]), &meta, sizeof(meta));
+
+	std::string& filename = mPool.new_object();
+	filename.swap(entry.mName);
+	fmeta.mName = make_slice(filename);
+
+	std::string& checks = mPool.new_object();
+	checks.swap(entry.mChecks);
+	fmeta.mChecks = make_slice(checks);
 
-	mOutput.seekp(meta_offset);
-	mOutput.write(&meta, sizeof(meta));
-	mOutput.seekp(end_offset);
+	mOutput.write(entry.mData.data(), integer_cast<int>(entry.mData.size()));
 	mOutput.flush();
 
 	BOOST_AUTO(result, mFileList.insert(std::make_pair(fmeta.mName, fmeta)));
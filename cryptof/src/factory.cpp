@@ -1,14 +1,24 @@
 
 #include "factory.h"
 #include "common/base64.h"
+#include "common/crc32c.h"
 #include "base64.h"
 #include "des.h"
 #include "aes.h"
+#include "aes_gcm.h"
 #include "blowfish.h"
+#include <mutex>
 
 std::map<int, std::string> FileNameCrypto;
 std::map<int, std::string> FileDataCrypto;
 
+typedef std::shared_ptr<Crypto> CryptoPtr;
+
+// prototypes of cached_coder by "code\nkey", dropped all at once when full
+static const size_t kMaxCachedCoders = 64;
+static std::mutex sCoderLock;
+static std::unordered_map<std::string, CryptoPtr> sCoderCache;
+
 void init_global()
 {
 	// file name:
@@ -30,6 +40,14 @@ void init_global()
 	// extend:(data)
 	FileDataCrypto[v2.second + 1] = "BASE64";    // v3
 	FileDataCrypto[v2.second + 1] = "DES";       // v4
+	FileDataCrypto[v2.second + 2] = "AES-GCM";   // 4, authenticated per chunk
+
+	// compressed, then encrypted:
+	FileDataCrypto[v2.second + 3] = "LZ4 -> AES";       // 5
+	FileDataCrypto[v2.second + 4] = "ZSTD -> AES";      // 6
+	FileDataCrypto[v2.second + 5] = "LZ4 -> AES-GCM";   // 7
+	FileDataCrypto[v2.second + 6] = "ZSTD -> AES-GCM";  // 8
+	FileDataCrypto[v2.second + 7] = "XPRESS -> AES";    // 9
 }
 
 void encode_filename(std::string& dest, const Slice& filename, const Slice& key, int version)
@@ -41,7 +59,7 @@ void encode_filename(std::string& dest, const Slice& filename, const Slice& key,
 	}
 	else
 	{
-		CryptoPipeline pipe(FileNameCrypto[version], key, new_coder);
+		CryptoPipeline pipe(FileNameCrypto[version], key, cached_coder);
 
 		pipe.encode(filename)
 			.copy_to(&dest);
@@ -57,13 +75,24 @@ void decode_filename(std::string& dest, const Slice& filename, const Slice& key,
 	}
 	else
 	{
-		CryptoPipeline pipe(FileNameCrypto[version], key, new_coder);
+		CryptoPipeline pipe(FileNameCrypto[version], key, cached_coder);
 
 		pipe.decode(filename)
 			.copy_to(&dest);
 	}
 }
 
+void append_checks(std::string& dest, const u_char* data, int size, int chunk)
+{
+	SMART_ASSERT(chunk > 0);
+	for (int pos = 0; pos < size; pos += chunk)
+	{
+		const int n = std::min(chunk, size - pos);
+		const uint32_t check = crc32c::Value((const char *)data + pos, integer_cast<size_t>(n));
+		dest.append((const char *)&check, sizeof(check));
+	}
+}
+
 Crypto* new_coder(const Slice& code, const Slice& key)
 {
 	if (code.icompare("AES") == 0)
@@ -82,6 +111,10 @@ Crypto* new_coder(const Slice& code, const Slice& key)
 	{
 		return new BlowfishCrypto(key);
 	}
+	else if (code.icompare("AES-GCM") == 0)
+	{
+		return new AESGCMCrypto(key);
+	}
 
 	SMART_ASSERT(0).msg("code not support");
 	return nullptr;
@@ -105,7 +138,43 @@ Crypto* new_coder2(const eCrypto& code, const Slice& key)
 	{
 		return new BlowfishCrypto(key);
 	}
+	else if (code == eCrypto::kAESGCM)
+	{
+		return new AESGCMCrypto(key);
+	}
 
 	SMART_ASSERT(0).msg("code not support");
 	return nullptr;
 }
+
+Crypto* cached_coder(const Slice& code, const Slice& key)
+{
+	std::string id = code.to_string();
+	id.push_back('\n');
+	id.append(key.data(), key.size());
+
+	CryptoPtr proto;
+	{
+		std::lock_guard<std::mutex> guard(sCoderLock);
+		BOOST_AUTO(iter, sCoderCache.find(id));
+		if (iter != sCoderCache.end())
+		{
+			proto = iter->second;
+		}
+	}
+
+	if (!proto)
+	{
+		proto.reset(new_coder(code, key));
+
+		std::lock_guard<std::mutex> guard(sCoderLock);
+		if (sCoderCache.size() >= kMaxCachedCoders)
+		{
+			sCoderCache.clear();
+		}
+		sCoderCache.insert(std::make_pair(id, proto));
+	}
+
+	Crypto* coder = proto->clone();
+	return (coder != nullptr) ? coder : new_coder(code, key);
+}
@@ -0,0 +1,250 @@
+
+#include "parallel.h"
+#include <map>
+
+ParallelCoder::ParallelCoder(const std::string& desc, const Slice& key, int threads)
+  : mChunkBlocks(0)
+  , mSumLeaf(0)
+  , mWorking(0)
+  , mStop(false)
+{
+	SMART_ASSERT(threads > 0)("threads", threads);
+	for (int i = 0; i < threads; ++i)
+	{
+		mPipes.push_back(CryptoPipelinePtr(new CryptoPipeline(desc, key, cached_coder)));
+	}
+
+	// two chunks per worker in flight, plus the ones held by reader and writer
+	mChunks.resize(integer_cast<size_t>(threads * 2 + 2));
+}
+
+ParallelCoder::~ParallelCoder()
+{
+}
+
+void ParallelCoder::set_iv(const Slice& iv)
+{
+	for (size_t i = 0; i < mPipes.size(); ++i)
+	{
+		mPipes[i]->set_iv(iv);
+	}
+}
+
+void ParallelCoder::set_length(uint64_t length)
+{
+	for (size_t i = 0; i < mPipes.size(); ++i)
+	{
+		mPipes[i]->set_length(length);
+	}
+}
+
+uint64_t ParallelCoder::encode(InputFileStream& input, uint64_t length, OutputFileStream& output, CheckSum& sum, std::string& checks)
+{
+	const int chunk = integer_cast<int>(read_bsize() * chunk_blocks(read_bsize()));
+	return run(input, length, chunk, output, std::numeric_limits<uint64_t>::max(), sum, &checks);
+}
+
+uint64_t ParallelCoder::decode(InputFileStream& input, uint64_t length, OutputFileStream& output, uint64_t filesize, CheckSum& sum)
+{
+	const int chunk = integer_cast<int>(write_bsize() * chunk_blocks(write_bsize()));
+	return run(input, length, chunk, output, filesize, sum, nullptr);
+}
+
+uint64_t ParallelCoder::run(InputFileStream& input, uint64_t length, int chunk, OutputFileStream& output, uint64_t limit, CheckSum& sum, std::string* checks)
+{
+	const bool encode = (checks != nullptr);
+	mChunkBlocks = integer_cast<uint64_t>(chunk / (encode ? read_bsize() : write_bsize()));
+	mSumLeaf = sum.parallel() ? sum.leaf() : 0;
+
+	for (size_t i = 0; i < mChunks.size(); ++i)
+	{
+		CodeChunk* free = &(mChunks[i]);
+		if (!input.mapped())
+		{
+			free->mInput.resize(integer_cast<size_t>(chunk));
+		}
+		mFree.Write(std::move(free));
+	}
+
+	mWorking = integer_cast<int>(mPipes.size());
+	std::vector<std::thread> workers;
+	for (size_t i = 0; i < mPipes.size(); ++i)
+	{
+		workers.push_back(std::thread(&ParallelCoder::work_loop, this, mPipes[i].get(), encode));
+	}
+	std::thread reader(&ParallelCoder::read_loop, this, std::ref(input), length, chunk);
+
+	// write the chunks back in file order
+	std::exception_ptr write_error;
+	std::map<uint64_t, CodeChunk*> pending;
+	uint64_t next = 0;
+	uint64_t total = 0;
+	CodeChunk* done = nullptr;
+	while (mDone.Read(done))
+	{
+		pending.insert(std::make_pair(done->mSeq, done));
+		while (!pending.empty() && pending.begin()->first == next)
+		{
+			CodeChunk* item = pending.begin()->second;
+			pending.erase(pending.begin());
+			++next;
+
+			if (!mStop)
+			{
+				try
+				{
+					const u_char* plain = encode ? item->mData : item->mOutput.data();
+					int nplain = encode ? item->mInSize : item->mOutSize;
+					int nwrite = item->mOutSize;
+					if (integer_cast<uint64_t>(nwrite) > limit)
+					{
+						nwrite = integer_cast<int>(limit);
+						nplain = nwrite;
+					}
+
+					limit -= nwrite;
+					total += nplain;
+					// the leaves of a truncated (last) chunk cover its padding
+					const int full = encode ? item->mInSize : item->mOutSize;
+					if (mSumLeaf > 0 && nplain == full)
+					{
+						sum.append_leaves(item->mSums);
+					}
+					else
+					{
+						sum.update(plain, integer_cast<size_t>(nplain));
+					}
+					output.write(item->mOutput.data(), nwrite);
+					if (encode)
+					{
+						checks->append(item->mChecks);
+					}
+				}
+				catch (...)
+				{
+					write_error = std::current_exception();
+					mStop = true;
+				}
+			}
+
+			mFree.Write(std::move(item));
+		}
+	}
+
+	reader.join();
+	for (size_t i = 0; i < workers.size(); ++i)
+	{
+		workers[i].join();
+	}
+
+	if (mReadError)
+		std::rethrow_exception(mReadError);
+
+	if (mWorkError)
+		std::rethrow_exception(mWorkError);
+
+	if (write_error)
+		std::rethrow_exception(write_error);
+
+	return total;
+}
+
+void ParallelCoder::read_loop(InputFileStream& input, uint64_t length, int chunk)
+{
+	uint64_t seq = 0;
+	CodeChunk* item = nullptr;
+	while (!mStop && length > 0 && mFree.Read(item))
+	{
+		int nread = chunk;
+		if (integer_cast<uint64_t>(nread) > length)
+			nread = integer_cast<int>(length);
+
+		try
+		{
+			if (input.mapped())
+			{
+				Slice view = input.read_view(nread);
+				item->mData   = (const u_char *)view.data();
+				item->mInSize = view.size();
+			}
+			else
+			{
+				item->mData   = &(item->mInput[0]);
+				item->mInSize = input.read(&(item->mInput[0]), nread);
+			}
+		}
+		catch (...)
+		{
+			mReadError = std::current_exception();
+			mStop = true;
+			break;
+		}
+
+		if (item->mInSize == 0)
+			break;
+
+		length -= item->mInSize;
+		item->mSeq = seq++;
+		mTodo.Write(std::move(item));
+	}
+
+	mTodo.SendEof();
+}
+
+void ParallelCoder::work_loop(CryptoPipeline* pipe, bool encode)
+{
+	CodeChunk* item = nullptr;
+	while (mTodo.Read(item))
+	{
+		item->mOutSize = 0;
+		if (!mStop)
+		{
+			try
+			{
+				pipe->seek(item->mSeq * mChunkBlocks);
+				Slice result = encode
+					? pipe->encode(item->mData, item->mInSize)
+					: pipe->decode(item->mData, item->mInSize);
+
+				// the result of a chunk can be empty, keep data() valid
+				const u_char* data = (const u_char *)result.data();
+				item->mOutput.assign(data, data + result.size());
+				item->mOutSize = result.size();
+
+				// whole chunks are a multiple of CHECK_BLOCKS write blocks
+				if (encode)
+				{
+					item->mChecks.clear();
+					append_checks(item->mChecks, (const u_char *)result.data(), result.size(), integer_cast<int>(pipe->write_bsize() * CHECK_BLOCKS));
+				}
+
+				if (mSumLeaf > 0)
+				{
+					item->mSums.clear();
+					if (encode)
+						append_checks(item->mSums, item->mData, item->mInSize, mSumLeaf);
+					else
+						append_checks(item->mSums, item->mOutput.data(), item->mOutSize, mSumLeaf);
+				}
+			}
+			catch (...)
+			{
+				// e.g. a chunk failing authentication, the first error wins
+				std::lock_guard<std::mutex> guard(mErrorLock);
+				if (!mWorkError)
+				{
+					mWorkError = std::current_exception();
+				}
+				mStop = true;
+			}
+		}
+
+		mDone.Write(std::move(item));
+	}
+
+	// the last worker closes the writer's queue
+	if (--mWorking == 0)
+	{
+		mDone.SendEof();
+	}
+}
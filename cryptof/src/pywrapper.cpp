@@ -1,6 +1,7 @@
 
 #include <Python.h>
 #include "structmember.h"
+#include <mutex>
 #include "encode_file.h"
 #include "decode_file.h"
 
@@ -44,6 +45,91 @@ static Slice Decode2UTF8(PyObject* input, PyObject** utf8)
     return Slice();
 }
 
+/* Drops the GIL for the native work of one call; the coder lock keeps
+   other threads off the same Encoder/Decoder meanwhile. */
+class AllowThreads : boost::noncopyable
+{
+public:
+    explicit AllowThreads(std::mutex* lock)
+        : mLock(lock), mState(PyEval_SaveThread())
+    {
+        mLock->lock();
+    }
+
+    ~AllowThreads()
+    {
+        mLock->unlock();
+        PyEval_RestoreThread(mState);
+    }
+
+private:
+    std::mutex*    mLock;
+    PyThreadState* mState;
+};
+
+/* Holds the coder lock with the GIL kept, without blocking the
+   interpreter while another thread is inside the coder. */
+class CoderLock : boost::noncopyable
+{
+public:
+    explicit CoderLock(std::mutex* lock)
+        : mLock(lock)
+    {
+        if (!mLock->try_lock())
+        {
+            Py_BEGIN_ALLOW_THREADS
+            mLock->lock();
+            Py_END_ALLOW_THREADS
+        }
+    }
+
+    ~CoderLock()
+    {
+        mLock->unlock();
+    }
+
+private:
+    std::mutex* mLock;
+};
+
+/* Reads [offset, offset + length) of fsrc into data, in pieces read_range
+   can address. Call without the GIL. */
+static bool ReadRange(DecodeFile* coder, const Slice& fsrc, uint64_t offset, uint64_t length, std::vector<char>& data)
+{
+    static const uint64_t kPiece = 1 << 30;
+
+    try
+    {
+        data.resize(static_cast<size_t>(length));
+    }
+    catch (std::exception&)
+    {
+        return false;
+    }
+
+    for (uint64_t done = 0; done < length; )
+    {
+        int piece = static_cast<int>(std::min(kPiece, length - done));
+        int size = coder->read_range(fsrc, offset + done, piece, &data[static_cast<size_t>(done)]);
+        if (size < 0)
+        {
+            return false;
+        }
+        if (size == 0)
+        {
+            break;
+        }
+        done += size;
+        if (size < piece)
+        {
+            data.resize(static_cast<size_t>(done));
+            break;
+        }
+    }
+
+    return true;
+}
+
 BEGIN_C
 
 /* CryptoMeta */
@@ -52,6 +138,7 @@ typedef struct
     PyObject_HEAD
     PyObject* mMd5Sum;
     uint64_t  mFileEnd;
+    uint64_t  mRawSize;
     int       mFileNameVersion;
     int       mFileDataVersion;
     int       mFileNameLength;
@@ -63,6 +150,7 @@ static PyMemberDef Meta_members[] =
     { (char *)"name_v",   T_INT,       offsetof(Meta, mFileNameVersion), READONLY, (char *)"file name version" },
     { (char *)"data_v",   T_INT,       offsetof(Meta, mFileDataVersion), READONLY, (char *)"file data version" },
     { (char *)"name_len", T_INT,       offsetof(Meta, mFileNameLength),  READONLY, (char *)"file name length"  },
+    { (char *)"raw_size", T_ULONGLONG, offsetof(Meta, mRawSize),         READONLY, (char *)"uncompressed size" },
     { (char *)"md5sum",   T_OBJECT_EX, offsetof(Meta, mMd5Sum),          READONLY, (char *)"file md5sum"       },
     { NULL }  /* Sentinel */
 };
@@ -78,6 +166,7 @@ static PyObject* Meta_new(PyTypeObject *type, PyObject* args, PyObject* kwargs)
     self->mFileDataVersion = v1.second;
     self->mFileNameLength  = 0;
     self->mFileEnd         = 0;
+    self->mRawSize         = 0;
 
     return (PyObject *)self;
 }
@@ -171,6 +260,7 @@ static PyObject* CryptoMeta2PyObject(const CryptoMeta& meta)
     item->mFileDataVersion = meta.mFileDataVersion;
     item->mFileNameLength  = meta.mFileNameLength;
     item->mFileEnd         = meta.mFileEnd;
+    item->mRawSize         = meta.mRawSize;
 
     if (meta.mMd5SumLength > 0)
     {
@@ -301,6 +391,80 @@ static PyObject* FileMeta2PyObject(const FileMeta& fmeta)
     return (PyObject *)item;
 };
 
+/* Buffer: decoded bytes in native memory, exported through memoryview */
+typedef struct
+{
+    PyObject_HEAD
+    std::vector<char>* data;
+} Buffer;
+
+static void Buffer_dealloc(Buffer* self)
+{
+    delete self->data;
+    self->data = NULL;
+    self->ob_type->tp_free((PyObject *)self);
+}
+
+static int Buffer_getbuffer(Buffer* self, Py_buffer* view, int flags)
+{
+    static char empty[1] = { 0 };
+    char* data = self->data->empty() ? empty : &(*self->data)[0];
+    return PyBuffer_FillInfo(view, (PyObject *)self, data,
+        integer_cast<Py_ssize_t>(self->data->size()), 1, flags);
+}
+
+static PyBufferProcs Buffer_as_buffer =
+{
+    0,                         /*bf_getreadbuffer*/
+    0,                         /*bf_getwritebuffer*/
+    0,                         /*bf_getsegcount*/
+    0,                         /*bf_getcharbuffer*/
+    (getbufferproc)Buffer_getbuffer,/*bf_getbuffer*/
+    0,                         /*bf_releasebuffer*/
+};
+
+static PyTypeObject BufferType =
+{
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "cryptof.Buffer",          /*tp_name*/
+    sizeof(Buffer),            /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    (destructor)Buffer_dealloc,/*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+    0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    &Buffer_as_buffer,         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER,/*tp_flags*/
+    "Buffer objects, read-only native memory behind Decoder.read",/* tp_doc */
+};
+
+/* takes ownership of data */
+static PyObject* NewMemoryView(std::vector<char>* data)
+{
+    Buffer* buffer = PyObject_New(Buffer, &BufferType);
+    if (buffer == NULL)
+    {
+        delete data;
+        return NULL;
+    }
+
+    buffer->data = data;
+    PyObject* view = PyMemoryView_FromObject((PyObject *)buffer);
+    Py_DECREF(buffer);
+    return view;
+}
+
 static PyObject* FileList2Dict(const FileList& flist)
 {
     PyObject* dict = PyDict_New();
@@ -330,6 +494,7 @@ typedef struct
 {
     PyObject_HEAD
     EncodeFile* coder;  
+    std::mutex* lock;
 } Encoder;
 
 static PyObject* Encoder_new(PyTypeObject* type, PyObject* args, PyObject* kwargs)
@@ -340,6 +505,7 @@ static PyObject* Encoder_new(PyTypeObject* type, PyObject* args, PyObject* kwarg
     if (self == NULL) return NULL;
 
     self->coder = NULL;
+    self->lock = new std::mutex();
 
     return (PyObject *)self;
 }
@@ -382,16 +548,20 @@ static void Encoder_dealloc(Encoder* self)
 {
     delete self->coder;
     self->coder = NULL;
+    delete self->lock;
+    self->lock = NULL;
     self->ob_type->tp_free((PyObject *)self);
 }
 
 static PyObject* Encoder_filelist(Encoder* self, PyObject* args)
 {
+    CoderLock lock(self->lock);
     return FileList2Dict(self->coder->filelist());
 }
 
 static PyObject* Encoder_version(Encoder* self, PyObject* args)
 {
+    CoderLock lock(self->lock);
     CryptoVersion version = self->coder->default_version();
     return Py_BuildValue("(ii)", version.first, version.second);
 }
@@ -404,10 +574,85 @@ static PyObject* Encoder_setVersion(Encoder* self, PyObject* args)
         return NULL;
     }
 
+    CoderLock lock(self->lock);
     self->coder->default_version(version);
     Py_RETURN_TRUE;
 }
 
+static PyObject* Encoder_setThreads(Encoder* self, PyObject* args)
+{
+    int threads = 1;
+    if (!PyArg_ParseTuple(args, "i", &threads))
+    {
+        return NULL;
+    }
+
+    CoderLock lock(self->lock);
+    self->coder->threads(threads);
+    Py_RETURN_TRUE;
+}
+
+static PyObject* Encoder_setDirectIO(Encoder* self, PyObject* args)
+{
+    PyObject* enable = NULL;
+    if (!PyArg_ParseTuple(args, "O", &enable))
+    {
+        return NULL;
+    }
+
+    bool result = false;
+    {
+        AllowThreads allow(self->lock);
+        result = self->coder->direct_io(PyObject_IsTrue(enable) == 1);
+    }
+
+    if (result)
+    {
+        Py_RETURN_TRUE;
+    }
+    else
+    {
+        Py_RETURN_FALSE;
+    }
+}
+
+static PyObject* Encoder_setChecksum(Encoder* self, PyObject* args)
+{
+    int type = kSumMD5;
+    if (!PyArg_ParseTuple(args, "i", &type))
+    {
+        return NULL;
+    }
+
+    if (type < kSumMD5 || type >= kSumMax)
+    {
+        PyErr_SetString(CryptofError, "unknown checksum type");
+        return NULL;
+    }
+
+    CoderLock lock(self->lock);
+    self->coder->checksum(type);
+    Py_RETURN_TRUE;
+}
+
+static PyObject* Encoder_close(Encoder* self, PyObject* args)
+{
+    bool result = false;
+    {
+        AllowThreads allow(self->lock);
+        result = self->coder->close();
+    }
+
+    if (result)
+    {
+        Py_RETURN_TRUE;
+    }
+    else
+    {
+        Py_RETURN_FALSE;
+    }
+}
+
 static PyObject* Encoder_str(PyObject* obj)  
 {
     Encoder* self = (Encoder *)obj;
@@ -425,7 +670,11 @@ static PyObject* Encoder_push(Encoder* self, PyObject* args, PyObject* kwargs)
 {
     static const char* kwlist[] = { "input", "version", NULL };
 
-    CryptoVersion version = self->coder->default_version();
+    CryptoVersion version;
+    {
+        CoderLock lock(self->lock);
+        version = self->coder->default_version();
+    }
     PyObject* input = NULL;
     if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|(ii)", const_cast<char **>(kwlist),
             &input, &version.first, &version.second))
@@ -434,10 +683,83 @@ static PyObject* Encoder_push(Encoder* self, PyObject* args, PyObject* kwargs)
     }
 
     PyObject* inUni = NULL;
-    bool result = self->coder->push(Decode2UTF8(input, &inUni), &version);
+    Slice file = Decode2UTF8(input, &inUni);
+    bool result = false;
+    if (!file.empty())
+    {
+        AllowThreads allow(self->lock);
+        result = self->coder->push(file, &version);
+    }
 
     Py_XDECREF(inUni);
 
+    if (PyErr_Occurred())
+    {
+        return NULL;
+    }
+
+    if (result)
+    {
+        Py_RETURN_TRUE;
+    }
+    else
+    {
+        Py_RETURN_FALSE;
+    }
+}
+
+static PyObject* Encoder_pushMany(Encoder* self, PyObject* args, PyObject* kwargs)
+{
+    static const char* kwlist[] = { "inputs", "threads", "version", NULL };
+
+    CryptoVersion version;
+    {
+        CoderLock lock(self->lock);
+        version = self->coder->default_version();
+    }
+    PyObject* inputs = NULL;
+    int threads = 1;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|i(ii)", const_cast<char **>(kwlist),
+            &inputs, &threads, &version.first, &version.second))
+    {
+        return NULL;
+    }
+
+    PyObject* seq = PySequence_Fast(inputs, "inputs must be a sequence");
+    if (seq == NULL)
+    {
+        return NULL;
+    }
+
+    const Py_ssize_t count = PySequence_Fast_GET_SIZE(seq);
+    std::vector<Slice> files;
+    std::vector<PyObject*> utf8(count, (PyObject*)NULL);
+    bool valid = true;
+    for (Py_ssize_t i = 0; i < count && valid; ++i)
+    {
+        Slice file = Decode2UTF8(PySequence_Fast_GET_ITEM(seq, i), &utf8[i]);
+        valid = !file.empty();
+        files.push_back(file);
+    }
+
+    bool result = false;
+    if (valid)
+    {
+        AllowThreads allow(self->lock);
+        result = self->coder->push_many(files, threads, &version);
+    }
+
+    for (Py_ssize_t i = 0; i < count; ++i)
+    {
+        Py_XDECREF(utf8[i]);
+    }
+    Py_DECREF(seq);
+
+    if (PyErr_Occurred())
+    {
+        return NULL;
+    }
+
     if (result)
     {
         Py_RETURN_TRUE;
@@ -460,7 +782,9 @@ static PyObject* Encoder_meta(Encoder* self, PyObject* args, PyObject* kwargs)
 
     FileMeta fmeta;
     PyObject* inUni = NULL;
-    if (self->coder->get(Decode2UTF8(input, &inUni), fmeta))
+    Slice file = Decode2UTF8(input, &inUni);
+    CoderLock lock(self->lock);
+    if (!self->coder->get(file, fmeta))
     {
         Py_XDECREF(inUni);
         Py_RETURN_NONE;
@@ -475,8 +799,13 @@ static PyMethodDef Encoder_methods[] =
     { "filelist", (PyCFunction)Encoder_filelist, METH_NOARGS, "noargs, Return the file list in encoder file" },
     { "version",  (PyCFunction)Encoder_version,  METH_NOARGS, "noargs, Return the encoder's version" },
     { "push",     (PyCFunction)Encoder_push,     METH_VARARGS | METH_KEYWORDS, "args:(input, version), Push a file into encoder file" },
+    { "push_many", (PyCFunction)Encoder_pushMany, METH_VARARGS | METH_KEYWORDS, "args:(inputs, threads, version), Push a list of files with coder threads" },
     { "meta",     (PyCFunction)Encoder_meta,     METH_VARARGS | METH_KEYWORDS, "args:(input), Get filemeta in encoder file" },
     { "set_version", (PyCFunction)Encoder_setVersion,  METH_VARARGS, "args:(version), Set the encoder's default version" },
+    { "set_threads", (PyCFunction)Encoder_setThreads,  METH_VARARGS, "args:(threads), Set the coder threads per file" },
+    { "set_checksum", (PyCFunction)Encoder_setChecksum,  METH_VARARGS, "args:(type), Set the checksum of new entries, 0: md5, 1: crc32c" },
+    { "set_direct_io", (PyCFunction)Encoder_setDirectIO,  METH_VARARGS, "args:(enable), Write the encoder file with O_DIRECT, False if unsupported" },
+    { "close",    (PyCFunction)Encoder_close,    METH_NOARGS, "noargs, Write the directory and close the encoder file" },
     { NULL, NULL, 0, NULL }  /* Sentinel */
 };
 
@@ -528,6 +857,7 @@ typedef struct
 {
     PyObject_HEAD
     DecodeFile* coder;  
+    std::mutex* lock;
 } Decoder;
 
 static PyObject* Decoder_new(PyTypeObject* type, PyObject* args, PyObject* kwargs)
@@ -538,6 +868,7 @@ static PyObject* Decoder_new(PyTypeObject* type, PyObject* args, PyObject* kwarg
     if (self == NULL) return NULL;
 
     self->coder = NULL;
+    self->lock = new std::mutex();
 
     return (PyObject *)self;
 }
@@ -578,12 +909,20 @@ static void Decoder_dealloc(Decoder* self)
 {
     delete self->coder;
     self->coder = NULL;
+    delete self->lock;
+    self->lock = NULL;
     self->ob_type->tp_free((PyObject *)self);
 }
 
 static PyObject* Decoder_load(Decoder* self, PyObject* args)
 {
-    if (self->coder->load())
+    bool result = false;
+    {
+        AllowThreads allow(self->lock);
+        result = self->coder->load();
+    }
+
+    if (result)
     {
         Py_RETURN_TRUE;
     }
@@ -595,6 +934,7 @@ static PyObject* Decoder_load(Decoder* self, PyObject* args)
 
 static PyObject* Decoder_filelist(Decoder* self, PyObject* args)
 {
+    CoderLock lock(self->lock);
     return FileList2Dict(self->coder->filelist());
 }
 
@@ -621,11 +961,23 @@ static PyObject* Decoder_pop(Decoder* self, PyObject* args, PyObject* kwargs)
 
     PyObject* inUni = NULL;
     PyObject* outUni = NULL;
-    bool result = self->coder->pop(Decode2UTF8(input, &inUni), Decode2UTF8(output, &outUni));
+    Slice file = Decode2UTF8(input, &inUni);
+    Slice dest = Decode2UTF8(output, &outUni);
+    bool result = false;
+    if (!file.empty() && !dest.empty())
+    {
+        AllowThreads allow(self->lock);
+        result = self->coder->pop(file, dest);
+    }
 
     Py_XDECREF(inUni);
     Py_XDECREF(outUni);
 
+    if (PyErr_Occurred())
+    {
+        return NULL;
+    }
+
     if (result)
     {
         Py_RETURN_TRUE;
@@ -636,6 +988,19 @@ static PyObject* Decoder_pop(Decoder* self, PyObject* args, PyObject* kwargs)
     }
 }
 
+static PyObject* Decoder_setThreads(Decoder* self, PyObject* args)
+{
+    int threads = 1;
+    if (!PyArg_ParseTuple(args, "i", &threads))
+    {
+        return NULL;
+    }
+
+    CoderLock lock(self->lock);
+    self->coder->threads(threads);
+    Py_RETURN_TRUE;
+}
+
 static PyObject* Decoder_meta(Decoder* self, PyObject* args, PyObject* kwargs)
 {
     static const char* kwlist[] = { "input", NULL };
@@ -648,7 +1013,9 @@ static PyObject* Decoder_meta(Decoder* self, PyObject* args, PyObject* kwargs)
 
     FileMeta fmeta;
     PyObject* inUni = NULL;
-    if (self->coder->get(Decode2UTF8(input, &inUni), fmeta))
+    Slice file = Decode2UTF8(input, &inUni);
+    CoderLock lock(self->lock);
+    if (!self->coder->get(file, fmeta))
     {
         Py_XDECREF(inUni);
         Py_RETURN_NONE;
@@ -658,12 +1025,85 @@ static PyObject* Decoder_meta(Decoder* self, PyObject* args, PyObject* kwargs)
     return FileMeta2PyObject(fmeta);
 }
 
+static PyObject* Decoder_readImpl(Decoder* self, PyObject* input, uint64_t offset, uint64_t length)
+{
+    PyObject* inUni = NULL;
+    Slice file = Decode2UTF8(input, &inUni);
+    if (file.empty())
+    {
+        Py_XDECREF(inUni);
+        return NULL;
+    }
+
+    std::vector<char>* data = new std::vector<char>();
+    bool result = false;
+    {
+        AllowThreads allow(self->lock);
+
+        FileMeta fmeta;
+        if (self->coder->get(file, fmeta))
+        {
+            offset = std::min(offset, fmeta.plain_size());
+            length = std::min(length, fmeta.plain_size() - offset);
+            result = ReadRange(self->coder, file, offset, length, *data);
+
+            // the whole entry: check it like pop() does
+            if (result && offset == 0 && data->size() == fmeta.plain_size())
+            {
+                result = self->coder->verify(file, data->empty() ? NULL : &(*data)[0], data->size());
+            }
+        }
+    }
+
+    Py_XDECREF(inUni);
+
+    if (!result)
+    {
+        delete data;
+        Py_RETURN_NONE;
+    }
+
+    return NewMemoryView(data);
+}
+
+static PyObject* Decoder_read(Decoder* self, PyObject* args, PyObject* kwargs)
+{
+    static const char* kwlist[] = { "input", NULL };
+
+    PyObject* input = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O", const_cast<char **>(kwlist), &input))
+    {
+        return NULL;
+    }
+
+    return Decoder_readImpl(self, input, 0, ~uint64_t(0));
+}
+
+static PyObject* Decoder_readRange(Decoder* self, PyObject* args, PyObject* kwargs)
+{
+    static const char* kwlist[] = { "input", "offset", "length", NULL };
+
+    PyObject* input = NULL;
+    unsigned PY_LONG_LONG offset = 0;
+    unsigned PY_LONG_LONG length = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "OKK", const_cast<char **>(kwlist),
+            &input, &offset, &length))
+    {
+        return NULL;
+    }
+
+    return Decoder_readImpl(self, input, offset, length);
+}
+
 static PyMethodDef Decoder_methods[] =
 {
     { "load",     (PyCFunction)Decoder_load,     METH_NOARGS, "noargs, Load a encoder file" },
     { "filelist", (PyCFunction)Decoder_filelist, METH_NOARGS, "noargs, Return the file list in encoder file" },
     { "pop",      (PyCFunction)Decoder_pop,      METH_VARARGS | METH_KEYWORDS, "args:(input, output), Pop a file from encoder file" },
     { "meta",     (PyCFunction)Decoder_meta,     METH_VARARGS | METH_KEYWORDS, "args:(input), Get filemeta in encoder file" },
+    { "read",     (PyCFunction)Decoder_read,     METH_VARARGS | METH_KEYWORDS, "args:(input), Decode a file into a memoryview" },
+    { "read_range", (PyCFunction)Decoder_readRange, METH_VARARGS | METH_KEYWORDS, "args:(input, offset, length), Decode a byte range of a file into a memoryview" },
+    { "set_threads", (PyCFunction)Decoder_setThreads, METH_VARARGS, "args:(threads), Set the coder threads per file" },
     { NULL, NULL, 0, NULL }  /* Sentinel */
 };
 
@@ -726,6 +1166,9 @@ PyMODINIT_FUNC initcryptof()
 
     CryptofError = PyErr_NewException((char *)"cryptof.Error", NULL, NULL);
 
+    if (PyType_Ready(&BufferType) < 0)
+        return ;
+
     if (PyType_Ready(&MetaType) < 0)
         return ;
 
@@ -756,5 +1199,8 @@ PyMODINIT_FUNC initcryptof()
 
     Py_INCREF(&DecoderType);
     PyModule_AddObject(m, "Decoder", (PyObject *)&DecoderType);
+
+    Py_INCREF(&BufferType);
+    PyModule_AddObject(m, "Buffer", (PyObject *)&BufferType);
 }
 
@@ -44,7 +44,7 @@ int main(int argc, char* argv[])
 {
 	if (argc < 2)
 	{
-		std::cout << argv[0] << " [files]" << std::endl;
+		std::cout << argv[0] << " [-j threads] [files]" << std::endl;
 		return 0;
 	}
 
@@ -53,11 +53,32 @@ int main(int argc, char* argv[])
 
 	CryptoManager manager;
 
+	// -j N: pack all files in one batch with N threads
+	int first = 1;
+	int threads = 0;
+	if (argc > 3 && strcmp(argv[1], "-j") == 0)
+	{
+		threads = atoi(argv[2]);
+		first = 3;
+	}
+
 	FileElement elem;
-	for (int i = 1; i < argc; ++i)
+	if (threads > 0)
+	{
+		std::vector<Slice> files;
+		for (int i = first; i < argc; ++i)
+		{
+			files.push_back(new_strp(argv[i]));
+		}
+		manager.push_many(tarfile, files, threads, elem);
+	}
+	else
 	{
-		elem.mFileName = new_strp(argv[i]);
-		manager.push(tarfile, elem);
+		for (int i = first; i < argc; ++i)
+		{
+			elem.mFileName = new_strp(argv[i]);
+			manager.push(tarfile, elem);
+		}
 	}
 
 	DecodeFilePtr decoder = manager.get_decoder(tarfile, key);
@@ -35,21 +35,10 @@ public:
 
 	bool push(const Slice& tarfile, const FileElement& elem)
 	{
-		BOOST_AUTO(iter, mEncoder.find(tarfile));
-		if (iter == mEncoder.end())
-		{
-			std::string& str = mFiles.new_object();
-			tarfile.copy_to(&str);
-			Slice output = make_slice(str);
-
-			EncodeFilePtr encoder(new EncodeFile(output, elem.mKey));
-			encoder->default_version(elem.mVersion);
-
-			BOOST_AUTO(result, mEncoder.insert(std::make_pair(output, encoder)));
-			if (!result.second) return false;
-			iter = result.first;
-		}
+		EncodeFilePtr encoder = open_encoder(tarfile, elem);
+		if (!encoder) return false;
 
+		BOOST_AUTO(iter, mEncoder.find(tarfile));
 		const CryptoVersion default_version = iter->second->default_version();
 		const CryptoVersion* version = &default_version;
 		if (elem.mVersion != *version)
@@ -71,6 +60,23 @@ public:
 		return true;
 	}
 
+	// elem.mFileName is ignored, the files are packed with `threads` threads
+	bool push_many(const Slice& tarfile, const std::vector<Slice>& files, int threads, const FileElement& elem)
+	{
+		EncodeFilePtr encoder = open_encoder(tarfile, elem);
+		if (!encoder) return false;
+
+		if (!encoder->push_many(files, threads, &(elem.mVersion)))
+			return false;
+
+		std::cout << "uuid: \"" << tarfile
+			<< "\", files: " << files.size()
+			<< ", threads: " << threads
+			<< std::endl;
+
+		return true;
+	}
+
 	bool pop(const Slice& tarfile, const FileElement& elem)
 	{
 		BOOST_AUTO(iter, mDecoder.find(tarfile));
@@ -116,6 +122,27 @@ public:
 		return iter->second;
 	}
 
+private:
+	EncodeFilePtr open_encoder(const Slice& tarfile, const FileElement& elem)
+	{
+		BOOST_AUTO(iter, mEncoder.find(tarfile));
+		if (iter == mEncoder.end())
+		{
+			std::string& str = mFiles.new_object();
+			tarfile.copy_to(&str);
+			Slice output = make_slice(str);
+
+			EncodeFilePtr encoder(new EncodeFile(output, elem.mKey));
+			encoder->default_version(elem.mVersion);
+
+			BOOST_AUTO(result, mEncoder.insert(std::make_pair(output, encoder)));
+			if (!result.second) return EncodeFilePtr();
+			iter = result.first;
+		}
+
+		return iter->second;
+	}
+
 private:
 	typedef std::unordered_map<Slice, EncodeFilePtr, SliceHash> EncoderList;
 	typedef std::unordered_map<Slice, DecodeFilePtr, SliceHash> DecoderList;
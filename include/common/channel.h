@@ -7,6 +7,7 @@
 #define _CHANNEL_H_
 
 #include <condition_variable>
+#include <functional>
 #include <mutex>
 #include <queue>
 #include <utility>
@@ -0,0 +1,143 @@
+
+// Block compressors beside port::Snappy_*, each one compiled in when its
+// macro is defined (LZ4, ZSTD, XPRESS). The functions return false when the
+// compressor is not supported by this build.
+
+#ifndef _COMPRESSION_H_
+#define _COMPRESSION_H_
+
+#include <stddef.h>
+#include <string.h>
+#include <string>
+
+#ifdef LZ4
+    #include <lz4.h>
+#endif
+#ifdef ZSTD
+    #include <zstd.h>
+#endif
+#ifdef XPRESS
+    #include "xpress.h"
+#endif
+
+namespace port {
+
+inline bool LZ4_Supported()
+{
+#ifdef LZ4
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline bool LZ4_Compress(const char* input, size_t length, ::std::string* output)
+{
+#ifdef LZ4
+    if (length > static_cast<size_t>(LZ4_MAX_INPUT_SIZE))
+        return false;
+
+    output->resize(static_cast<size_t>(LZ4_compressBound(static_cast<int>(length))));
+    int outlen = LZ4_compress_default(input, &(*output)[0], static_cast<int>(length),
+                                      static_cast<int>(output->size()));
+    if (outlen <= 0)
+        return false;
+
+    output->resize(static_cast<size_t>(outlen));
+    return true;
+#else
+    return false;
+#endif
+}
+
+// output_length is the exact uncompressed size
+inline bool LZ4_Uncompress(const char* input, size_t length, char* output,
+                           size_t output_length)
+{
+#ifdef LZ4
+    int outlen = LZ4_decompress_safe(input, output, static_cast<int>(length),
+                                     static_cast<int>(output_length));
+    return outlen >= 0 && static_cast<size_t>(outlen) == output_length;
+#else
+    return false;
+#endif
+}
+
+inline bool ZSTD_Supported()
+{
+#ifdef ZSTD
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline bool ZSTD_Compress(const char* input, size_t length, ::std::string* output,
+                          int level = 3)
+{
+#ifdef ZSTD
+    output->resize(ZSTD_compressBound(length));
+    size_t outlen = ZSTD_compress(&(*output)[0], output->size(), input, length, level);
+    if (ZSTD_isError(outlen))
+        return false;
+
+    output->resize(outlen);
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline bool ZSTD_Uncompress(const char* input, size_t length, char* output,
+                            size_t output_length)
+{
+#ifdef ZSTD
+    size_t outlen = ZSTD_decompress(output, output_length, input, length);
+    return !ZSTD_isError(outlen) && outlen == output_length;
+#else
+    return false;
+#endif
+}
+
+inline bool XPRESS_Supported()
+{
+#ifdef XPRESS
+    return true;
+#else
+    return false;
+#endif
+}
+
+inline bool XPRESS_Compress(const char* input, size_t length, ::std::string* output)
+{
+#ifdef XPRESS
+    return port::xpress::Compress(input, length, output);
+#else
+    return false;
+#endif
+}
+
+inline bool XPRESS_Uncompress(const char* input, size_t length, char* output,
+                              size_t output_length)
+{
+#ifdef XPRESS
+    int outlen = 0;
+    char* result = port::xpress::Decompress(input, length, &outlen);
+    if (result == nullptr)
+        return false;
+
+    const bool ok = (static_cast<size_t>(outlen) == output_length);
+    if (ok)
+    {
+        memcpy(output, result, output_length);
+    }
+    delete[] result;
+    return ok;
+#else
+    return false;
+#endif
+}
+
+} // namespace port
+
+#endif  // _COMPRESSION_H_
@@ -21,6 +21,16 @@ inline uint32_t Value(const char* data, size_t n)
     return Extend(0, data, n);
 }
 
+// Return the crc32c of concat(A, B) where crc_a is the crc32c of A and
+// crc_b is the crc32c of B, a string of len_b bytes.  Neither A nor B
+// is needed, so checksums of adjacent pieces can be merged afterwards.
+extern uint32_t Combine(uint32_t crc_a, uint32_t crc_b, uint64_t len_b);
+
+// Return the crc32c of data[0,n-1], computed by up to "threads" threads
+// on separate pieces that are then merged with Combine().  Buffers too
+// small to be worth splitting are summed on the calling thread.
+extern uint32_t Value(const char* data, size_t n, int threads);
+
 static const uint32_t kMaskDelta = 0xa282ead8ul;
 
 // Return a masked representation of crc.
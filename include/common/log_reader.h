@@ -6,11 +6,15 @@
 #define _LOG_READER_H_
 
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 #include "slice.h"
 #include "status.h"
 #include "log_format.h"
+#include "port.h"
 
+class RandomAccessFile;
 class SequentialFile;
 
 class LogReader
@@ -36,6 +40,10 @@ public:
     //
     // If "checksum" is true, verify checksums if available.
     //
+    // With a file from Env::NewMmapSequentialFile() nothing is copied:
+    // kFullType records point straight into the mapping and only
+    // fragmented records are assembled in "*scratch".
+    //
     // The LogReader will start reading at the first record located at physical
     // position >= initial_offset within the file.
     LogReader(SequentialFile* file, Reporter* reporter, bool checksum,
@@ -76,6 +84,9 @@ private:
     // Return type, or one of the preceding special values
     unsigned int ReadPhysicalRecord(Slice* result);
 
+    // Expands a batch record into batch_, returns false if it is corrupted.
+    bool ExpandBatch(const Slice& payload);
+
     // Reports dropped bytes to the reporter.
     // buffer_ must be updated to remove the dropped bytes prior to invocation.
     void ReportCorruption(uint64_t bytes, Slice reason);
@@ -105,6 +116,73 @@ private:
     // particular, a run of kMiddleType and kLastType records can be silently
     // skipped in this mode
     bool resyncing_;
+
+    // Records of the last batch record not returned yet, inside batch_
+    std::string batch_;
+    Slice batch_records_;
+};
+
+// Reads a whole log with several threads: the blocks are read and their
+// checksums verified in parallel (no fragment crosses a block boundary),
+// the records are put back together and delivered in order on the
+// calling thread.  Best used with an mmap based RandomAccessFile, whose
+// reads do not copy.
+class ParallelLogReader
+{
+public:
+    // Receives the records, in the order they were written.
+    class Handler
+    {
+    public:
+        virtual ~Handler();
+
+        // "record" is only valid during the call, "offset" is its physical
+        // offset in the file.  Return false to stop reading.
+        virtual bool Record(const Slice& record, uint64_t offset) = 0;
+    };
+
+    // "*file" holds "file_size" bytes of log and must remain live while
+    // this ParallelLogReader is in use, as must "*reporter" if non-NULL;
+    // the reporter is only called on the thread of ReadAll().
+    // At most 2 * "threads" chunks of blocks are held in memory.
+    ParallelLogReader(RandomAccessFile* file, uint64_t file_size,
+                      LogReader::Reporter* reporter, bool checksum, int threads);
+
+    ~ParallelLogReader();
+
+    // Deliver all records to "*handler".  Returns the error of a failed
+    // read, the records before it have been delivered.
+    Status ReadAll(Handler* handler);
+
+private:
+    struct Fragment;
+    struct Chunk;
+
+    bool DeliverBatch(const Slice& payload, uint64_t offset, Handler* handler,
+                      std::string* contents);
+    void ParseChunk(uint64_t index, Chunk* chunk) const;
+    void ParseBlock(const char* block, size_t size, uint64_t offset,
+                    std::vector<Fragment>* fragments) const;
+    void Worker();
+
+    // No copying allowed
+    ParallelLogReader(const ParallelLogReader&);
+    void operator=(const ParallelLogReader&);
+
+private:
+    RandomAccessFile* const file_;
+    uint64_t const file_size_;
+    LogReader::Reporter* const reporter_;
+    bool const checksum_;
+    int const threads_;
+
+    port::Mutex mu_;
+    port::CondVar cv_;
+    std::vector<Chunk*> window_;  // chunk i is parsed into window_[i % size]
+    uint64_t num_chunks_;
+    uint64_t next_chunk_;         // next chunk a worker takes
+    uint64_t consumed_;           // chunks delivered so far
+    bool stop_;
 };
 
 #endif  // _LOG_READER_H_
@@ -6,7 +6,10 @@
 #define _LOG_WRITER_H_
 
 #include <stdint.h>
+#include <deque>
+#include <string>
 #include "log_format.h"
+#include "port.h"
 #include "slice.h"
 #include "status.h"
 
@@ -29,8 +32,20 @@ public:
 
     Status AddRecord(const Slice& slice);
 
+    // Append "n" records with a single dest_->Append(), followed by a
+    // Sync() if "sync" and a Flush() otherwise.
+    Status AddRecords(const Slice* slices, size_t n, bool sync);
+
+    // Like AddRecords(), but the records are packed into one batch record
+    // compressed with "compression", or stored when that does not help.
+    // LogReader returns them one by one.
+    Status AddBatch(const Slice* slices, size_t n,
+                    log_format::BatchCompression compression, bool sync);
+
 private:
-    Status EmitPhysicalRecord(log_format::RecordType type, const char* ptr, size_t length);
+    Status AppendPending(bool sync);
+    void FormatRecord(const Slice& slice, bool batch);
+    void FormatPhysicalRecord(log_format::RecordType type, const char* ptr, size_t length);
 
     // No copying allowed
     LogWriter(const LogWriter&);
@@ -44,6 +59,48 @@ private:
     // pre-computed to reduce the overhead of computing the crc of the
     // record type stored in the header.
     uint32_t type_crc_[log_format::kMaxRecordType + 1];
+
+    // Headers and payloads of the records being appended.
+    std::string pending_;
+
+    // Contents of a batch record, uncompressed and compressed.
+    std::string raw_;
+    std::string compressed_;
+};
+
+// Group commit in front of a LogWriter: any number of threads may call
+// AddRecord() concurrently.  The thread at the head of the queue becomes
+// the leader and writes the records of the threads queued behind it with
+// one Append() and at most one Sync(), then wakes them up.
+class GroupLogWriter
+{
+public:
+    // "*log" must remain live while this GroupLogWriter is in use and
+    // must not be written to directly meanwhile.
+    //
+    // If "batch" is true, groups of several records are written as one
+    // batch record compressed with "compression".
+    explicit GroupLogWriter(LogWriter* log, bool batch = false,
+                            log_format::BatchCompression compression = log_format::kBatchNoCompression);
+
+    ~GroupLogWriter();
+
+    // Returns once the record is in the log, synced if "sync".
+    Status AddRecord(const Slice& slice, bool sync = false);
+
+private:
+    struct Waiter;
+
+    // No copying allowed
+    GroupLogWriter(const GroupLogWriter&);
+    void operator=(const GroupLogWriter&);
+
+private:
+    LogWriter* log_;
+    bool const batch_;
+    log_format::BatchCompression const compression_;
+    port::Mutex mu_;
+    std::deque<Waiter*> waiters_;
 };
 
 #endif  // _LOG_WRITER_H_
@@ -5,10 +5,15 @@
 #include "preprocessor.h"
 #include "noncopyable.h"
 #include "smart_assert.h"
+#include <stdlib.h>
 #include <new>
 #include <typeinfo>
 #include <type_traits>
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
 namespace detail {
 
     template <class T>
@@ -64,7 +69,81 @@ namespace detail {
     }
 } // namespace detail
 
-template <class T>
+// default block allocation: plain heap memory
+struct MallocPolicy
+{
+    static void* allocate(size_t size)
+    {
+        return malloc(size);
+    }
+
+    static void deallocate(void* p, size_t /* size */)
+    {
+        free(p);
+    }
+};
+
+// blocks of at least one huge page are mapped with MAP_HUGETLB when the system
+// has huge pages reserved, otherwise with 2 MB aligned anonymous memory advised
+// for transparent huge pages; smaller blocks and other systems use malloc
+struct HugePagePolicy
+{
+    enum { kHugePageSize = 2u << 20 };
+
+    static void* allocate(size_t size)
+    {
+#if defined(__linux__)
+        if (size >= kHugePageSize)
+        {
+            const size_t length = huge_length(size);
+#ifdef MAP_HUGETLB
+            static bool hugetlb = true;
+            if (hugetlb)
+            {
+                void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (p != MAP_FAILED)
+                    return p;
+                hugetlb = false; // nothing reserved, don't retry for every block
+            }
+#endif // MAP_HUGETLB
+            char* p = (char *)mmap(nullptr, length + kHugePageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == (char *)MAP_FAILED)
+                return nullptr;
+
+            // trim the mapping to a huge page boundary on both ends
+            const size_t head = (kHugePageSize - (uintptr_t)p % kHugePageSize) % kHugePageSize;
+            if (head != 0u)
+                munmap(p, head);
+            munmap(p + head + length, kHugePageSize - head);
+#ifdef MADV_HUGEPAGE
+            madvise(p + head, length, MADV_HUGEPAGE);
+#endif // MADV_HUGEPAGE
+            return p + head;
+        }
+#endif // __linux__
+        return malloc(size);
+    }
+
+    static void deallocate(void* p, size_t size)
+    {
+#if defined(__linux__)
+        if (size >= kHugePageSize)
+        {
+            munmap(p, huge_length(size));
+            return;
+        }
+#endif // __linux__
+        free(p);
+    }
+
+private:
+    static size_t huge_length(size_t size)
+    {
+        return (size + kHugePageSize - 1) / kHugePageSize * kHugePageSize;
+    }
+};
+
+template <class T, class Alloc = MallocPolicy>
 class ObjectPool : boost::noncopyable
 {
 public:
@@ -93,7 +172,7 @@ public:
             BlockNode* p = node;
             node = node->mNext;
             destory(p);
-            free(p);
+            Alloc::deallocate(p, block_size());
         }
     }
 
@@ -176,7 +255,7 @@ public:
             BlockNode* p = node;
             node = p->mNext;
             destory(p);
-            free(p);
+            Alloc::deallocate(p, block_size());
             mCapacity -= mNum;
         }
 
@@ -212,6 +291,11 @@ public:
     BlockNode* data() { return mHead; }
 
 private:
+    size_t block_size() const
+    {
+        return sizeof(BlockNode) + sizeof(T) * mNum;
+    }
+
     void destory(BlockNode* node)
     {
         const typename std::is_pod<T>::type* ptype = nullptr;
@@ -234,7 +318,7 @@ private:
 
     BlockNode* reserve()
     {
-        BlockNode* node = (BlockNode *)malloc(sizeof(BlockNode) + sizeof(T) * mNum);
+        BlockNode* node = (BlockNode *)Alloc::allocate(block_size());
         if (node == nullptr)
         {
             throw std::bad_alloc();
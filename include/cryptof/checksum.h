@@ -0,0 +1,44 @@
+
+#ifndef _CHECKSUM_H_
+#define _CHECKSUM_H_
+
+#include "utils.h"
+#include "cryptopp/md5.h"
+#include <string>
+
+enum eCheckSum
+{
+	kSumMD5,    // old archives
+	kSumCRC32C, // crc32c over the crc32c of every leaf
+	kSumMax
+};
+
+// checksum of the plain data of an entry, recorded in CryptoMeta::mMd5Sum.
+// kSumCRC32C splits the data into leaves of a fixed size, so the leaves can
+// be summed by the coder threads and handed in with append_leaves().
+class CheckSum : boost::noncopyable
+{
+public:
+	CheckSum(int type, int leaf);
+
+	int  type() const { return mType; }
+	int  leaf() const { return mLeaf; }
+	bool parallel() const { return mType == kSumCRC32C; }
+
+	void update(const u_char* data, size_t size);
+
+	// crc32c of whole leaves (see append_checks), the data so far must end on a leaf
+	void append_leaves(const std::string& leaves);
+
+	std::string final();
+
+private:
+	int                 mType;
+	int                 mLeaf;
+	CryptoPP::Weak::MD5 mMd5;
+	std::string         mLeaves;
+	uint32_t            mPartial;
+	int                 mPartialSize;
+};
+
+#endif // _CHECKSUM_H_
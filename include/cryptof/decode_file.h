@@ -20,11 +20,32 @@ public:
 	bool get(const Slice& fsrc, FileMeta& fmeta);
 	bool pop(const Slice& fsrc, const Slice& fdest);
 
+	// decode [offset, offset + length) of an entry into buffer, only the covering
+	// blocks are read (compressed entries: the stream up to the range end);
+	// returns the bytes copied (short at the end of the entry),
+	// -1 if the entry is unknown or the data fails its integrity check;
+	// entries of archives written before the check list are not checked
+	int read_range(const Slice& fsrc, uint64_t offset, int length, void* buffer);
+
+	// true if data is the whole plain content of an entry, by the checksum pop() checks;
+	// read_range() checks the coded chunks only, not the entry as a whole
+	bool verify(const Slice& fsrc, const void* data, uint64_t size);
+
+	// coder threads per entry, 1 keeps everything on the calling thread
+	int  threads() const { return mThreads; }
+	void threads(int n)  { mThreads = (n > 0) ? n : 1; }
+
 	const FileList& filelist() const { return mFileList; }
 
 private:
 	bool load_impl();
+	bool load_index();
+	bool load_scan();
+	Slice decode_name(const Slice& name, const CryptoMeta& meta);
 	bool pop_impl(const FileMeta& fmeta, const Slice& fdest);
+	bool match_sum(const FileMeta& fmeta, CheckSum& sum);
+	int  read_range_impl(const FileMeta& fmeta, uint64_t offset, int length, char* buffer);
+	int  read_frames(const FileMeta& fmeta, CryptoPipeline& pipe, uint64_t offset, int length, char* buffer);
 
 private:
 	InputFileStream mInput;
@@ -32,6 +53,7 @@ private:
 	FileList        mFileList;
 	StringPool      mPool;
 	BufferPool      mBuffPool;
+	int             mThreads;
 };
 
 typedef std::shared_ptr<DecodeFile> DecodeFilePtr;
@@ -7,11 +7,16 @@
 #include "common/slice.h"
 #include "common/noncopyable.h"
 #include <memory>
+#include <vector>
+
+struct PackedEntry;
+struct PackBatch;
 
 class EncodeFile : boost::noncopyable
 {
 public:
 	EncodeFile(const Slice& output, const Slice& key = "a2b4c6d8e0,");
+	~EncodeFile();
 
 	CryptoVersion default_version() const
 	{
@@ -23,18 +28,81 @@ public:
 		mDefault = v;
 	}
 
+	// coder threads per entry, 1 keeps everything on the calling thread
+	int threads() const
+	{
+		return mThreads;
+	}
+
+	void threads(int n)
+	{
+		mThreads = (n > 0) ? n : 1;
+	}
+
+	// eCheckSum of new entries: kSumMD5 (default, readable by old decoders)
+	// or kSumCRC32C, summed in parallel by the coder threads
+	int checksum() const
+	{
+		return mCheckSum;
+	}
+
+	void checksum(int type)
+	{
+		SMART_ASSERT(type >= kSumMD5 && type < kSumMax)("type", type);
+		mCheckSum = type;
+	}
+
+	// write the directory trailer on close; off by default, decoders older than
+	// the directory fail to load archives that have one
+	bool index() const
+	{
+		return mIndex;
+	}
+
+	void index(bool enable)
+	{
+		mIndex = enable;
+	}
+
+	// write the archive with O_DIRECT, keeps large archives out of the page cache;
+	// false where the file system does not support it
+	bool direct_io() const
+	{
+		return mOutput.direct();
+	}
+
+	bool direct_io(bool enable)
+	{
+		return mOutput.direct(enable);
+	}
+
 	bool push(const Slice& fin, const CryptoVersion* version = nullptr);
+
+	// push files with `threads` coder threads, entries keep the list order;
+	// small files are coded in memory concurrently, large ones streamed by push()
+	bool push_many(const std::vector<Slice>& fins, int threads, const CryptoVersion* version = nullptr);
 	bool get(const Slice& fsrc, FileMeta& fmeta);
+	bool close();
 
 	const FileList& filelist() const { return mFileList; }
 
 private:
 	bool push_impl(const Slice& fin, const CryptoVersion& version);
+	uint64_t push_frames(InputFileStream& input, CryptoPipeline& pipe, CheckSum& sum, std::string& checks);
+	bool push_many_impl(const std::vector<Slice>& fins, int threads, const CryptoVersion& version);
+	void pack_impl(const Slice& fin, const CryptoVersion& version, PackedEntry& entry) const;
+	void pack_loop(PackBatch* batch);
+	bool push_packed(PackedEntry& entry);
+	void write_index();
 
 private:
 	OutputFileStream mOutput;
 	Slice            mKey;
 	CryptoVersion    mDefault;
+	int              mThreads;
+	int              mCheckSum;
+	bool             mIndex;
+	bool             mClosed;
 	FileList         mFileList;
 	StringPool       mPool;
 };
@@ -8,6 +8,7 @@
 #include "common/slice.h"
 #include "common/tools.h"
 #include "common/string_algo.h"
+#include "compress.h"
 #include <vector>
 
 #ifndef _HAVE_CXX11_
@@ -32,11 +33,50 @@ public:
 	virtual int  encode_outsize() const = 0;
 	virtual void encode(const u_char* input, u_char* output) = 0;
 
+	// encode nblocks consecutive blocks, returns the bytes written to output:
+	virtual int encode_blocks(const u_char* input, u_char* output, int nblocks)
+	{
+		const int blocksize = encode_blocksize();
+		u_char* dest = output;
+		for (int i = 0; i < nblocks; ++i)
+		{
+			encode(input, dest);
+			input += blocksize;
+			dest  += encode_outsize();
+		}
+		return integer_cast<int>(dest - output);
+	}
+
 	// decode:
 	virtual int  decode_blocksize() const = 0;
 	virtual int  decode_length(int len) const = 0;
 	virtual int  decode_outsize() const = 0;
 	virtual void decode(const u_char* input, u_char* output) = 0;
+
+	// decode nblocks consecutive blocks, returns the bytes written to output:
+	virtual int decode_blocks(const u_char* input, u_char* output, int nblocks)
+	{
+		const int blocksize = decode_blocksize();
+		u_char* dest = output;
+		for (int i = 0; i < nblocks; ++i)
+		{
+			decode(input, dest);
+			input += blocksize;
+			dest  += decode_outsize();
+		}
+		return integer_cast<int>(dest - output);
+	}
+
+	// coders that bind every block to a per-entry nonce and its index (AEAD):
+	virtual int  iv_size() const { return 0; }
+	virtual void set_iv(const u_char* iv, int len) {}
+	virtual void seek(uint64_t block) {}
+	// plain bytes of the whole stream, so that its last block can be sealed as such
+	virtual void set_length(uint64_t length) {}
+
+	// a fresh coder with the same key, sharing the prepared key schedule
+	// where possible; nullptr if the coder can not be cloned
+	virtual Crypto* clone() const { return nullptr; }
 };
 
 class CryptoProxy : boost::noncopyable
@@ -80,11 +120,10 @@ public:
 		const u_char* src = data;
 		u_char* dest = mBuffer;
 		SMART_ASSERT(src != nullptr && dest != nullptr);
-		for (int i = 0; i < blocks; ++i)
+		if (blocks > 0)
 		{
-			mCoder->encode(src, dest);
-			src  += in_block;
-			dest += out_block;
+			dest += mCoder->encode_blocks(src, dest, blocks);
+			src  += in_block * blocks;
 		}
 
 		if (remain > 0)
@@ -121,11 +160,9 @@ public:
 		const u_char* src = data;
 		u_char* dest = mBuffer;
 		SMART_ASSERT(src != nullptr && dest != nullptr);
-		for (int i = 0; i < blocks; ++i)
+		if (blocks > 0)
 		{
-			mCoder->decode(src, dest);
-			src  += blocksize;
-			dest += mCoder->decode_outsize();
+			dest += mCoder->decode_blocks(src, dest, blocks);
 		}
 
 		return make_slice(mBuffer, dest);
@@ -136,6 +173,21 @@ public:
 		return decode((const u_char *)str.data(), str.size());
 	}
 
+	void set_iv(const Slice& iv)
+	{
+		mCoder->set_iv((const u_char *)iv.data(), iv.size());
+	}
+
+	void seek(uint64_t block)
+	{
+		mCoder->seek(block);
+	}
+
+	void set_length(uint64_t length)
+	{
+		mCoder->set_length(length);
+	}
+
 	const Crypto* operator->() const
 	{
 		return mCoder.get();
@@ -206,12 +258,23 @@ public:
 	CryptoPipeline(const std::string& desc, const Slice& key, const CreateCoder& create)
 		: mReadBSize(1)
 		, mWriteBSize(1)
+		, mCompress(kNoCompress)
 	{
 		std::vector<Slice> codelist;
 		split(codelist, desc, PIPE_SEP);
 		for (BOOST_AUTO(iter, codelist.begin()); iter != codelist.end(); ++iter)
 		{
 			iter->trim();
+
+			// compression works on the whole entry, ahead of the block coders
+			const int compress = compress_type(*iter);
+			if (compress != kNoCompress)
+			{
+				SMART_ASSERT(mPipeList.empty() && mCompress == kNoCompress).msg("compression must lead the pipeline");
+				mCompress = compress;
+				continue;
+			}
+
 			Crypto* coder = create(*iter, key);
 			CryptoProxyPtr pipe(new CryptoProxy(coder));
 			SMART_ASSERT((*pipe)->encode_blocksize() > 0);
@@ -219,11 +282,61 @@ public:
 			mReadBSize  = integer_cast<int>(lcm(mReadBSize,  (*pipe)->encode_blocksize()));
 			mWriteBSize = integer_cast<int>(lcm(mWriteBSize, (*pipe)->encode_length(mReadBSize)));
 		}
+
+		int stage_in = mReadBSize;
+		for (BOOST_AUTO(pipe, mPipeList.begin()); pipe != mPipeList.end(); ++pipe)
+		{
+			mStageIn.push_back(stage_in);
+			stage_in = (**pipe)->encode_length(stage_in);
+		}
 	}
 
 	int read_bsize()  const { return mReadBSize;  }
 	int write_bsize() const { return mWriteBSize; }
 
+	// eCompress of the leading stage, the entry data is then a frame stream
+	int compress() const { return mCompress; }
+
+	int iv_size() const
+	{
+		int size = 0;
+		for (BOOST_AUTO(pipe, mPipeList.begin()); pipe != mPipeList.end(); ++pipe)
+		{
+			size = std::max(size, (**pipe)->iv_size());
+		}
+
+		return size;
+	}
+
+	void set_iv(const Slice& iv)
+	{
+		for (BOOST_AUTO(pipe, mPipeList.begin()); pipe != mPipeList.end(); ++pipe)
+		{
+			(*pipe)->set_iv(iv);
+		}
+	}
+
+	// bytes entering the pipeline for the whole entry, every stage gets the length of its input
+	void set_length(uint64_t length)
+	{
+		for (BOOST_AUTO(pipe, mPipeList.begin()); pipe != mPipeList.end(); ++pipe)
+		{
+			(*pipe)->set_length(length);
+			const uint64_t bsize = integer_cast<uint64_t>((**pipe)->encode_blocksize());
+			length = (length + bsize - 1) / bsize * integer_cast<uint64_t>((**pipe)->encode_outsize());
+		}
+	}
+
+	// continue at pipeline block `block` (read_bsize() plain, write_bsize() coded bytes)
+	void seek(uint64_t block)
+	{
+		for (size_t i = 0; i < mPipeList.size(); ++i)
+		{
+			CryptoProxy& pipe = *(mPipeList[i]);
+			pipe.seek(block * mStageIn[i] / pipe->encode_blocksize());
+		}
+	}
+
 	Slice encode(Slice src)
 	{
 		for (BOOST_AUTO(pipe, mPipeList.begin()); pipe != mPipeList.end(); ++pipe)
@@ -256,8 +369,10 @@ public:
 
 private:
 	std::vector<CryptoProxyPtr> mPipeList;
+	std::vector<int>            mStageIn; // stage input bytes per pipeline block
 	int mReadBSize;
 	int mWriteBSize;
+	int mCompress;
 };
 
 #endif // _INTERFACT_H_
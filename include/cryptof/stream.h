@@ -6,12 +6,30 @@
 #include "utils.h"
 #include "common/slice.h"
 #include <fstream>
+#include <algorithm>
+
+#if defined(__linux__)
+#  include "common/linux/memory_mapped_file.h"
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <errno.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include "common/aligned_buffer.h"
+#  define INPUT_MMAP 1
+#  define OUTPUT_FD 1
+#  define OUTPUT_ALIGNMENT 4096
+#  define OUTPUT_BUFSIZE (1 << 20)
+#endif // __linux__
 
 class InputFileStream : boost::noncopyable
 {
 public:
 	InputFileStream(const Slice& filename)
 	  : mFileName(GetFileName(filename, mBuffer))
+#ifdef INPUT_MMAP
+	  , mAdviseFd(-1)
+#endif // INPUT_MMAP
 	{
 		mIn.open(mFileName.data(), std::ios::binary | std::ios::in);
 		if (!mIn.good())
@@ -19,6 +37,15 @@ public:
 			std::cerr << "\ninput: " << mFileName.data() << std::endl;
 			throw Exception("open input file failed");
 		}
+
+#ifdef INPUT_MMAP
+		// regular files are mapped as well, pipes and devices only use read()
+		struct stat st;
+		if (stat(mFileName.data(), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+		{
+			mMap.Map(mFileName.data(), 0);
+		}
+#endif // INPUT_MMAP
 	}
 
 	~InputFileStream()
@@ -37,6 +64,15 @@ public:
 		{
 			mIn.close();
 		}
+
+#ifdef INPUT_MMAP
+		mMap.Unmap();
+		if (mAdviseFd >= 0)
+		{
+			::close(mAdviseFd);
+			mAdviseFd = -1;
+		}
+#endif // INPUT_MMAP
 	}
 
 	void clear()
@@ -44,6 +80,50 @@ public:
 		mIn.clear();
 	}
 
+	// the whole file is mapped, read_view() can be used instead of read()
+	bool mapped() const
+	{
+#ifdef INPUT_MMAP
+		return mMap.data() != nullptr;
+#else
+		return false;
+#endif // INPUT_MMAP
+	}
+
+	// [offset, offset + length) is read front to back, the kernel can read further ahead there;
+	// the rest of the mapping keeps its advice for random access
+	void hint_sequential(uint64_t offset, uint64_t length)
+	{
+#ifdef INPUT_MMAP
+		if (mapped())
+		{
+			advise_map(offset, length, MADV_SEQUENTIAL);
+		}
+#endif // INPUT_MMAP
+	}
+
+	// start loading [offset, offset + length) of the file in the background,
+	// an unmapped file is advised through its own fd, ifstream does not expose one
+	void prefetch(uint64_t offset, uint64_t length)
+	{
+#ifdef INPUT_MMAP
+		if (mapped())
+		{
+			advise_map(offset, length, MADV_WILLNEED);
+			return;
+		}
+
+		if (mAdviseFd < 0)
+		{
+			mAdviseFd = ::open(mFileName.data(), O_RDONLY);
+		}
+		if (mAdviseFd >= 0)
+		{
+			posix_fadvise(mAdviseFd, integer_cast<off_t>(offset), integer_cast<off_t>(length), POSIX_FADV_WILLNEED);
+		}
+#endif // INPUT_MMAP
+	}
+
 	std::ios_base::seekdir beg() const { return mIn.beg; }
 	std::ios_base::seekdir end() const { return mIn.end; }
 	std::ios_base::seekdir cur() const { return mIn.cur; }
@@ -98,29 +178,97 @@ public:
 		return integer_cast<int>(mIn.gcount());
 	}
 
+	// like read(), but returns the mapped bytes instead of copying them
+	Slice read_view(int size)
+	{
+		SMART_ASSERT(mapped());
+#ifdef INPUT_MMAP
+		const std::streamoff pos = seekpos();
+		if (pos < 0 || integer_cast<size_t>(pos) >= mMap.size())
+			return Slice();
+
+		const size_t remain = mMap.size() - integer_cast<size_t>(pos);
+		if (integer_cast<size_t>(size) > remain)
+			size = integer_cast<int>(remain);
+
+		seekg(size, cur());
+		return make_slice((const char *)mMap.data() + pos, size);
+#else
+		return Slice();
+#endif // INPUT_MMAP
+	}
+
+private:
+#ifdef INPUT_MMAP
+	// madvise wants a page aligned start
+	void advise_map(uint64_t offset, uint64_t length, int advice)
+	{
+		if (offset >= mMap.size())
+			return;
+
+		length = std::min<uint64_t>(length, mMap.size() - offset);
+		const uint64_t page  = integer_cast<uint64_t>(getpagesize());
+		const uint64_t begin = offset & ~(page - 1);
+		madvise((char *)mMap.data() + begin, integer_cast<size_t>(length + offset - begin), advice);
+	}
+#endif // INPUT_MMAP
+
 private:
 	std::ifstream mIn;
 	Slice   mFileName;
 	std::vector<char> mBuffer;
+#ifdef INPUT_MMAP
+	MemoryMappedFile mMap;
+	int mAdviseFd;
+#endif // INPUT_MMAP
 };
 
+// sequential writer of the archives; on linux the file is written with a
+// raw fd through an aligned buffer, so it can be preallocated, switched to
+// O_DIRECT, and patched with pwrite() without moving the write position
 class OutputFileStream : boost::noncopyable
 {
 public:
 	OutputFileStream(const Slice& filename)
 	  : mFileName(GetFileName(filename, mBuffer))
+#ifdef OUTPUT_FD
+	  , mFd(-1)
+	  , mFlushed(0)
+	  , mSize(0)
+	  , mDirect(false)
+#endif // OUTPUT_FD
 	{
+#ifdef OUTPUT_FD
+		// O_RDWR: the partial head block is read back when direct I/O starts
+		mFd = ::open(mFileName.data(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (mFd < 0)
+		{
+			std::cerr << "\noutput: " << mFileName << std::endl;
+			throw Exception("open output file failed");
+		}
+
+		mData.Alignment(OUTPUT_ALIGNMENT);
+		mData.AllocateNewBuffer(OUTPUT_BUFSIZE);
+#else
 		mOut.open(mFileName.data(), std::ios::binary | std::ios::out | std::ios::trunc);
 		if (mOut.fail())
 		{
 			std::cerr << "\noutput: " << mFileName << std::endl;
 			throw Exception("open output file failed");
 		}
+#endif // OUTPUT_FD
 	}
 
 	~OutputFileStream()
 	{
-		close();
+		try
+		{
+			close();
+		}
+		catch (std::exception& ex)
+		{
+			std::cerr << "close Catch Exception: " << ex.what() << std::endl;
+		}
 	}
 
 	Slice name() const
@@ -130,55 +278,129 @@ public:
 
 	void close()
 	{
+#ifdef OUTPUT_FD
+		if (mFd >= 0)
+		{
+			const int fd = mFd;
+			try
+			{
+				write_buffer(true);
+			}
+			catch (...)
+			{
+				mFd = -1;
+				::close(fd);
+				throw;
+			}
+			mFd = -1;
+
+			// drops the padding of the last direct block and the unused preallocation
+			const int trunc = ftruncate(fd, integer_cast<off_t>(mSize));
+			if (::close(fd) != 0 || trunc != 0)
+			{
+				throw Exception("close output file failed");
+			}
+		}
+#else
 		if (mOut.is_open())
 		{
 			mOut.close();
 		}
+#endif // OUTPUT_FD
 	}
 
 	void clear()
 	{
+#ifndef OUTPUT_FD
 		mOut.clear();
+#endif // OUTPUT_FD
 	}
 
-	std::ios_base::seekdir beg() const { return mOut.beg; }
-	std::ios_base::seekdir end() const { return mOut.end; }
-	std::ios_base::seekdir cur() const { return mOut.cur; }
+	std::ios_base::seekdir beg() const { return std::ios_base::beg; }
+	std::ios_base::seekdir end() const { return std::ios_base::end; }
+	std::ios_base::seekdir cur() const { return std::ios_base::cur; }
 
 	OutputFileStream& seekp(const std::streampos& pos)
 	{
+#ifdef OUTPUT_FD
+		seek_to(static_cast<std::streamoff>(pos));
+#else
 		mOut.seekp(pos);
 		if (mOut.fail())
 		{
 			throw Exception("seekp file failed");
 		}
+#endif // OUTPUT_FD
 
 		return *this;
 	}
 
 	OutputFileStream& seekp(const std::streamoff& off, std::ios_base::seekdir way)
 	{
+#ifdef OUTPUT_FD
+		std::streamoff base = 0;
+		if (way == cur())
+		{
+			base = seekpos();
+		}
+		else if (way == end())
+		{
+			base = integer_cast<std::streamoff>(std::max(mSize, position()));
+		}
+		seek_to(base + off);
+#else
 		mOut.seekp(off, way);
 		if (mOut.fail())
 		{
 			throw Exception("seekp file failed");
 		}
+#endif // OUTPUT_FD
 
 		return *this;
 	}
 
 	std::streampos tellp()
 	{
-		return mOut.tellp();
+		return seekpos();
 	}
 
 	std::streamoff seekpos()
 	{
+#ifdef OUTPUT_FD
+		return integer_cast<std::streamoff>(position());
+#else
 		return mOut.tellp();
+#endif // OUTPUT_FD
 	}
 
 	int write(const void* buffer, int size)
 	{
+#ifdef OUTPUT_FD
+		SMART_ASSERT(mFd >= 0 && size >= 0);
+		const char* data = (const char *)buffer;
+		size_t remain = integer_cast<size_t>(size);
+
+		// buffered writes skip the copy of whole buffers
+		if (!mDirect && mData.CurrentSize() == 0 && remain >= mData.Capacity())
+		{
+			write_at(data, remain, mFlushed);
+			mFlushed += remain;
+			mSize = std::max(mSize, mFlushed);
+			return size;
+		}
+
+		while (remain > 0)
+		{
+			const size_t n = mData.Append(data, remain);
+			data += n;
+			remain -= n;
+			if (mData.CurrentSize() == mData.Capacity())
+			{
+				write_buffer(false);
+			}
+		}
+		mSize = std::max(mSize, position());
+#else
 		if (mOut.fail())
 		{
 			throw Exception("write data to file failed");
@@ -189,25 +411,253 @@ public:
 		{
 			throw Exception("write data to file failed");
 		}
+#endif // OUTPUT_FD
 
 		return size;
 	}
 
+	// overwrite bytes already written at offset, the write position stays
+	// where it is; patches the entry headers and metas without seeking
+	int pwrite(const void* buffer, int size, uint64_t offset)
+	{
+#ifdef OUTPUT_FD
+		SMART_ASSERT(size >= 0 && offset + size <= position())("offset", offset)("size", size);
+		const char* data = (const char *)buffer;
+		const uint64_t end = offset + size;
+
+		// the part still buffered is patched in memory
+		if (end > mFlushed)
+		{
+			const uint64_t from = std::max(offset, mFlushed);
+			memcpy(mData.BufferStart() + (from - mFlushed), data + (from - offset), integer_cast<size_t>(end - from));
+		}
+
+		// the part on disk is unaligned, written without O_DIRECT
+		if (offset < mFlushed)
+		{
+			const size_t n = integer_cast<size_t>(std::min(end, mFlushed) - offset);
+			const bool direct = mDirect;
+			if (direct) set_direct(false);
+			write_at(data, n, offset);
+			if (direct) set_direct(true);
+		}
+#else
+		const std::streampos pos = tellp();
+		seekp(integer_cast<std::streamoff>(offset), beg());
+		write(buffer, size);
+		seekp(pos);
+#endif // OUTPUT_FD
+
+		return size;
+	}
+
+	// write the file with O_DIRECT from now on, for large archives whose
+	// data would only pollute the page cache; only appends are direct, it
+	// returns false where the file system does not support it or behind
+	// the end of the file, the stream keeps buffered I/O then
+	bool direct(bool enable)
+	{
+#ifdef OUTPUT_FD
+		if (enable == mDirect)
+		{
+			return true;
+		}
+
+		if (!enable)
+		{
+			write_buffer(true);
+			set_direct(false);
+			return true;
+		}
+
+		// the padding of the last block would clobber the bytes behind
+		if (position() != mSize)
+		{
+			return false;
+		}
+
+		// O_DIRECT writes start at a block boundary: the head of the
+		// partial block goes back into the buffer
+		write_buffer(true);
+		const uint64_t head = mFlushed % mData.Alignment();
+		if (!set_direct(true))
+		{
+			return false;
+		}
+
+		if (head > 0)
+		{
+			set_direct(false);
+			const ssize_t n = ::pread(mFd, mData.BufferStart(), integer_cast<size_t>(head), integer_cast<off_t>(mFlushed - head));
+			set_direct(true);
+			if (n != integer_cast<ssize_t>(head))
+			{
+				throw Exception("read output file failed");
+			}
+
+			mData.Size(integer_cast<size_t>(head));
+			mFlushed -= head;
+		}
+		return true;
+#else
+		return !enable;
+#endif // OUTPUT_FD
+	}
+
+	bool direct() const
+	{
+#ifdef OUTPUT_FD
+		return mDirect;
+#else
+		return false;
+#endif // OUTPUT_FD
+	}
+
+	// reserve disk space up to size bytes ahead of the writes, a hint only:
+	// the file keeps its size and nothing changes where it is not supported,
+	// close() gives back what was not written
+	void preallocate(uint64_t size)
+	{
+#if defined(OUTPUT_FD) && defined(FALLOC_FL_KEEP_SIZE)
+		const uint64_t pos = position();
+		if (size > pos)
+		{
+			fallocate(mFd, FALLOC_FL_KEEP_SIZE, integer_cast<off_t>(pos), integer_cast<off_t>(size - pos));
+		}
+#endif // OUTPUT_FD
+	}
+
+	// with O_DIRECT the partial last block stays buffered until close()
 	OutputFileStream& flush()
 	{
+#ifdef OUTPUT_FD
+		write_buffer(false);
+#else
 		mOut.flush();
 		if (mOut.fail())
 		{
 			throw Exception("flush file data failed");
 		}
+#endif // OUTPUT_FD
 
 		return *this;
 	}
 
 private:
-	std::ofstream mOut;
+#ifdef OUTPUT_FD
+	uint64_t position() const
+	{
+		return mFlushed + mData.CurrentSize();
+	}
+
+	bool set_direct(bool enable)
+	{
+		const int flags = fcntl(mFd, F_GETFL);
+		if (flags < 0 || fcntl(mFd, F_SETFL, enable ? (flags | O_DIRECT) : (flags & ~O_DIRECT)) != 0)
+		{
+			return false;
+		}
+
+		mDirect = enable;
+		return true;
+	}
+
+	void write_at(const char* data, size_t size, uint64_t offset)
+	{
+		while (size > 0)
+		{
+			const ssize_t n = ::pwrite(mFd, data, size, integer_cast<off_t>(offset));
+			if (n < 0 && errno == EINTR)
+			{
+				continue;
+			}
+			if (n <= 0)
+			{
+				throw Exception("write data to file failed");
+			}
+
+			data += n;
+			size -= integer_cast<size_t>(n);
+			offset += integer_cast<uint64_t>(n);
+		}
+	}
+
+	// writes the buffer out; with O_DIRECT only whole blocks are written
+	// unless `all`, then the last block is padded and ftruncate()d on close
+	void write_buffer(bool all)
+	{
+		const size_t size = mData.CurrentSize();
+		if (size == 0)
+		{
+			return;
+		}
+
+		if (!mDirect)
+		{
+			write_at(mData.BufferStart(), size, mFlushed);
+			mFlushed += size;
+			mData.Clear();
+			return;
+		}
+
+		const size_t whole = TruncateToPageBoundary(mData.Alignment(), size);
+		if (whole == size || all)
+		{
+			mData.PadToAlignmentWith(0);
+			write_at(mData.BufferStart(), mData.CurrentSize(), mFlushed);
+			mData.Size(size);
+		}
+		else if (whole > 0)
+		{
+			write_at(mData.BufferStart(), whole, mFlushed);
+		}
+
+		// the tail block is rewritten once it fills up
+		mData.RefitTail(whole, size - whole);
+		mFlushed += whole;
+	}
+
+	void seek_to(std::streamoff pos)
+	{
+		if (pos < 0)
+		{
+			throw Exception("seekp file failed");
+		}
+
+		const uint64_t to = integer_cast<uint64_t>(pos);
+		if (to == position())
+		{
+			return;
+		}
+
+		// a padded block would clobber the bytes behind an earlier position
+		write_buffer(true);
+		if (mDirect)
+		{
+			set_direct(false);
+		}
+
+		if (mData.CurrentSize() > 0)
+		{
+			write_at(mData.BufferStart(), mData.CurrentSize(), mFlushed);
+			mData.Clear();
+		}
+		mFlushed = to;
+	}
+#endif // OUTPUT_FD
+
+private:
 	Slice   mFileName;
 	std::vector<char> mBuffer;
+#ifdef OUTPUT_FD
+	int      mFd;
+	uint64_t mFlushed; // file offset of the buffer start
+	uint64_t mSize;    // the logical file size
+	bool     mDirect;
+	AlignedBuffer mData;
+#else
+	std::ofstream mOut;
+#endif // OUTPUT_FD
 };
 
 #endif // _STREAM_H_
@@ -25,6 +25,7 @@ public:
 
     bool   add(const Slice& key, TUID id, bool whole_word = true);
     bool   compile();
+    bool   compile(const Slice& sample);
     bool   check() const;
     size_t wordset(value_set& store);
     TUID   find_key(const Slice& key) const;
@@ -25,6 +25,11 @@ bool Trie::compile()
 	return get_data()->compile();
 }
 
+bool Trie::compile(const Slice& sample)
+{
+	return get_data()->compile(sample, DecodeType::kNone);
+}
+
 bool Trie::check() const
 {
 	return get_data()->check();
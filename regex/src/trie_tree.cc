@@ -2,6 +2,8 @@
 #include "common/smart_assert.h"
 #include "common/string-inl.h"
 #include "trie_tree.h"
+#include <map>
+#include <queue>
 #include <set>
 
 #ifdef MINIMUM_LETTER_SET
@@ -27,7 +29,7 @@
 #define whole_word(pn, sp, s)      (((sp) + 1 == (pn).end() || IsSpace[static_cast<uint8_t>((sp)[1])]) \
                                      && ((sp) == (pn).begin() + (s)->mLength -1 || IsSpace[static_cast<uint8_t>((sp)[-(s)->mLength])]))
 #define output_state(pn, sp, s)    (endof_state(s) && ((s)->mMode == 0 || whole_word(pn, sp, s)))
-#define get_storage()              ((ObjectPool<detail::TrieNode> *)(mStorage))
+#define get_storage()              ((TrieNodePool *)(mStorage))
 #define get_wordpool()             ((ObjectPool<detail::EndNode>  *)(mWStorage))
 
 #if (MAX_LETTER_NUM < 256)
@@ -330,6 +332,9 @@ inline uint8_t detail::get_htmlentry(const char* &mark, const char* &sp, const c
     return TOUPPER(*sp);
 }
 
+// states are 4 KB+ each, blocks that span huge pages keep the hot path off the dTLB
+typedef ObjectPool<detail::TrieNode, HugePagePolicy> TrieNodePool;
+
 typedef detail::TrieNode* TrieNodePtr;
 typedef detail::EndNode*  EndNodePtr;
 
@@ -364,7 +369,7 @@ TrieTree::iterator& TrieTree::iterator::operator++()
 }
 
 TrieTree::TrieTree(uint32_t unit, bool lowercase)
-  : mStorage((uintptr_t)(new ObjectPool<detail::TrieNode>(unit > 0 ? unit : 128)))
+  : mStorage((uintptr_t)(new TrieNodePool(unit > 0 ? unit : 128)))
   , mWStorage((uintptr_t)(new ObjectPool<detail::EndNode>(unit > 0 ? unit : 256)))
   , mRoot((uintptr_t)(nullptr))
   , mWord((uintptr_t)(nullptr))
@@ -723,6 +728,124 @@ bool TrieTree::compile_move()
     return true;
 }
 
+namespace detail
+{
+    struct HotState
+    {
+        uint64_t  mHits;
+        uint32_t  mSeq;
+        TrieNode* mNode;
+
+        // the hottest state first, the earliest discovered one on ties
+        bool operator<(const HotState& other) const
+        {
+            return (mHits != other.mHits) ? (mHits < other.mHits) : (mSeq > other.mSeq);
+        }
+    };
+
+    inline TrieNode* relocated(const TrieNode* node)
+    {
+        return (node != nullptr) ? node->mNext : nullptr;
+    }
+} // namespace detail
+
+bool TrieTree::relocate(const Slice& sample, DecodeType decode)
+{
+    typedef std::map<TrieNodeConstPtr, uint64_t> HitMap;
+
+    const TrieNodePtr root = (const TrieNodePtr)(mRoot);
+    detail::pointer last = sample.end();
+    detail::pointer mark = nullptr;
+    HitMap hits;
+
+    // replay the transitions of search() over the sample
+    {
+        TrieNodePtr node = root;
+        uint8_t c = 0;
+        for (detail::pointer xpos = sample.begin(); xpos != last; ++xpos)
+        {
+            GET_LETTER(c, xpos, last);
+            node = get_move(node, c);
+            ++hits[node];
+        }
+    }
+
+    // best-first walk from the root: a state is placed only after its parent,
+    // and among the reachable ones the most visited goes first
+    std::vector<TrieNodePtr> order;
+    order.reserve(mNodes);
+
+    std::priority_queue<detail::HotState> q;
+    uint32_t seq = 0;
+    detail::HotState hot = { hits[root], seq++, root };
+    q.push(hot);
+
+    while (!q.empty())
+    {
+        TrieNodePtr r = q.top().mNode;
+        q.pop();
+        order.push_back(r);
+
+        for (size_t i = 0; i < dimensionof(r->mState); ++i)
+        {
+            const uint8_t c = static_cast<uint8_t>(i + MIN_LETTER);
+            if (go_state_fail(r, c))
+                continue;
+
+            TrieNodePtr s = go_state(r, c);
+            BOOST_AUTO(iter, hits.find(s));
+            hot.mHits = (iter != hits.end()) ? iter->second : 0u;
+            hot.mSeq  = seq++;
+            hot.mNode = s;
+            q.push(hot);
+        }
+    }
+
+    SMART_ASSERT(order.size() == mNodes)("order", order.size())("nodes", mNodes);
+    if (order.size() != mNodes)
+        return false;
+
+    // copy the states into one block, mNext (unused after compile) keeps the new address
+    TrieNodePool* storage = new TrieNodePool(mNodes);
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        detail::TrieNode& state = storage->new_object();
+        state = *order[i];
+        order[i]->mNext = &state;
+    }
+
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        TrieNodePtr s = order[i]->mNext;
+        for (size_t j = 0; j < dimensionof(s->mState); ++j)
+        {
+            s->mState[j] = detail::relocated(s->mState[j]);
+            s->mMove [j] = detail::relocated(s->mMove [j]);
+        }
+
+        s->mOutput.mNode = detail::relocated(s->mOutput.mNode);
+        s->mOutput.mNext = detail::relocated(s->mOutput.mNext);
+        s->mParent = detail::relocated(s->mParent);
+        s->mFail   = detail::relocated(s->mFail);
+    }
+
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        order[i]->mNext->mNext = nullptr;
+    }
+
+    for (EndNodePtr word = (EndNodePtr)mWord; word != nullptr; word = const_cast<EndNodePtr>(word->mNext))
+    {
+        word->mCur = detail::relocated(word->mCur);
+    }
+
+    mRoot = (uintptr_t)(root->mNext);
+    delete get_storage();
+    mStorage = (uintptr_t)(storage);
+
+    return true;
+}
+
 #define check_failure check_f
 bool TrieTree::check_failure(uintptr_t parent) const
 {
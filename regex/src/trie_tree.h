@@ -55,6 +55,7 @@ public:
 
     bool     add(const Slice& key, TNID id, bool whole_word = true, AddCallBack endof = nullptr, void* data = nullptr);
     bool     compile() { return compile_f() && compile_m(); }
+    bool     compile(const Slice& sample, DecodeType decode = kNone) { return compile() && relocate(sample, decode); }
     bool     check() const { return check_sibling() && check_f(mRoot) && check_m(mRoot); }
     TNID     find_key(const Slice& key) const;
     TNID     find_subkey(const Slice& key, MatchCallBack match, void* data = nullptr) const;
@@ -91,6 +92,7 @@ public:
 private:
     bool compile_f();
     bool compile_m();
+    bool relocate(const Slice& sample, DecodeType decode);
     bool check_sibling() const;
     bool check_f(uintptr_t r) const;
     bool check_m(uintptr_t r) const;
@@ -230,6 +230,30 @@ int main(int argc, char* argv[])
         ret = trie.search(content, DecodeType::kNone, match_break_func, &data);
         ASSERT_EQ(true, ret);
         ASSERT_EQ(1u, data.mCount);
+
+        TrieTree hot;
+        for (size_t i = 0; i < words.size(); i++)
+        {
+            ASSERT_EQ(true, hot.add(targets[i], i, false));
+        }
+        ASSERT_EQ(true, hot.compile(content));
+        ASSERT_EQ(true, hot.check());
+        ASSERT_EQ(trie.nodes(), hot.nodes());
+
+        for (TrieTree::iterator iter = hot.begin(); iter != hot.end(); ++iter)
+        {
+            BOOST_AUTO(ta, targets.find(iter->second));
+            ASSERT_EQ(ta->second, iter->first);
+        }
+
+        std::vector<TrieResult> hot_result;
+        hot.find_all(content, DecodeType::kNone, hot_result);
+        ASSERT_EQ(result.size(), hot_result.size());
+
+        data.mCount = 0;
+        ret = hot.search(content, DecodeType::kNone, match_func, &data);
+        ASSERT_EQ(false, ret);
+        ASSERT_EQ(count, data.mCount);
     }
 
     return report_errors();